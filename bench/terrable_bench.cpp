@@ -0,0 +1,708 @@
+// standalone benchmark for the Terrable simulation core, runnable without Houdini.
+// every measurement is printed as one JSON object per line so results can be collected and compared over time. the exit
+// status is 1 if the edge_flow check fails.
+//
+// usage: terrable_bench [--sizes 256,512,...] [--terrains noise,ramp,cone] [--threads 1,2,4,...]
+//                       [--events N] [--year-max-size N] [--seed N] [--output file.jsonl]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "layer_allocator.hpp"
+#include "numa.hpp"
+#include "random.hpp"
+#include "simd_kernels.hpp"
+#include "terrain_simulation.hpp"
+#include "thread_pool.hpp"
+
+using namespace Terrable;
+
+namespace
+{
+
+struct BenchConfig
+{
+    std::vector<int> sizes = { 256, 512, 1024, 2048, 4096, 8192 };
+    std::vector<std::string> terrains = { "noise", "ramp", "cone" };
+    std::vector<int> threadCounts;
+    int eventsPerType = 100000;
+    int yearMaxSize = 512; // full-year steps simulate size * size * numEvents events, so larger sizes are skipped by default
+    int seed = 0;
+    FILE* output = stdout;
+};
+
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        if (end > start)
+        {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+std::vector<int> splitIntList(const std::string& list)
+{
+    std::vector<int> values;
+    for (const auto& item : splitList(list))
+    {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+uint64_t getPeakRssBytes()
+{
+#if defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)usage.ru_maxrss;
+#elif defined(__unix__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)usage.ru_maxrss * 1024;
+#else
+    return 0;
+#endif
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// one line of JSON per measurement; items are events for event benchmarks and cells for grid passes
+void report(const BenchConfig& config, const char* benchmark, const std::string& terrain, int size, int threads,
+    uint64_t items, double seconds, const char* extraJson = "")
+{
+    const uint64_t layerBytes = (uint64_t)numTerrainLayers * size * size * sizeof(float);
+    std::fprintf(config.output,
+        "{\"benchmark\":\"%s\",\"terrain\":\"%s\",\"size\":%d,\"threads\":%d,\"items\":%llu,\"seconds\":%.6f,"
+        "\"items_per_sec\":%.1f,\"ns_per_item\":%.2f,\"layer_bytes\":%llu,\"peak_rss_bytes\":%llu,\"simd\":\"%s\",\"layout\":\"%s\","
+        "\"huge_pages\":\"%s\"%s}\n",
+        benchmark, terrain.c_str(), size, threads, (unsigned long long)items, seconds,
+        seconds > 0.0 ? items / seconds : 0.0, items > 0 ? seconds * 1e9 / items : 0.0,
+        (unsigned long long)layerBytes, (unsigned long long)getPeakRssBytes(), getSimdKernels().isaName,
+        TerrainSimulation::tiledLayout ? "tiled" : "row-major", hugePageModeNames[(int)getHugePages()].c_str(), extraJson);
+    std::fflush(config.output);
+}
+
+// synthetic heightfields use a cell size of 1, with heights chosen so typical slopes are around 0.1 - 1
+
+float hashToUnit(int x, int y, int seed)
+{
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u + (uint32_t)seed * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    h ^= h >> 16;
+    return (h & 0xFFFFFF) / (float)0x1000000;
+}
+
+float valueNoise(float x, float y, int seed)
+{
+    const int x0 = (int)std::floor(x);
+    const int y0 = (int)std::floor(y);
+    float tx = x - x0;
+    float ty = y - y0;
+    tx = tx * tx * (3.f - 2.f * tx);
+    ty = ty * ty * (3.f - 2.f * ty);
+
+    const float v00 = hashToUnit(x0, y0, seed);
+    const float v10 = hashToUnit(x0 + 1, y0, seed);
+    const float v01 = hashToUnit(x0, y0 + 1, seed);
+    const float v11 = hashToUnit(x0 + 1, y0 + 1, seed);
+    return (v00 * (1.f - tx) + v10 * tx) * (1.f - ty) + (v01 * (1.f - tx) + v11 * tx) * ty;
+}
+
+void generateTerrain(const std::string& terrain, int size, int seed, TerrainSimulation& simulation, ThreadPool& pool)
+{
+    pool.parallelFor(0, size, 16, [&](int rowBegin, int rowEnd)
+    {
+        std::vector<float> bedrockRow(size);
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                float value;
+                if (terrain == "ramp")
+                {
+                    value = 0.5f * x + 0.05f * y;
+                }
+                else if (terrain == "cone")
+                {
+                    const float dx = x - 0.5f * size;
+                    const float dy = y - 0.5f * size;
+                    value = 0.5f * (0.5f * size - std::sqrt(dx * dx + dy * dy));
+                }
+                else // noise: fBm with a base wavelength of 1/4 of the terrain
+                {
+                    value = 0.f;
+                    float frequency = 4.f / size;
+                    float amplitude = 0.15f * size;
+                    for (int octave = 0; octave < 6; ++octave)
+                    {
+                        value += amplitude * valueNoise(x * frequency, y * frequency, seed + octave);
+                        frequency *= 2.f;
+                        amplitude *= 0.5f;
+                    }
+                }
+                bedrockRow[x] = value;
+            }
+            simulation.writeLayerRow(TerrainLayer::BEDROCK, 0, y, size, bedrockRow.data());
+        }
+    });
+}
+
+// times count events of one type at uniformly random positions
+double timeEvents(TerrainSimulation& simulation, const std::function<void(int, int)>& simulateEvent, int count, int seed)
+{
+    Random positionRandom(seed);
+    const int width = simulation.getWidth();
+    const int height = simulation.getHeight();
+
+    std::vector<Vec2i> positions(count);
+    for (auto& pos : positions)
+    {
+        pos = Vec2i((int)(positionRandom.nextDouble() * width), (int)(positionRandom.nextDouble() * height));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& pos : positions)
+    {
+        simulateEvent(pos.x, pos.y);
+    }
+    return secondsSince(start);
+}
+
+// elevation sums to each gravity layer: "loop" is a runtime-bounded loop over the planes (how elevation was summed before
+// it was specialized), "dispatched" is the runtime-argument API, and "specialized" is the per-layer template
+void benchElevation(const BenchConfig& config, const std::string& terrain, int size, const TerrainSimulation& simulation)
+{
+    constexpr int numRepeats = 64;
+    const int count = config.eventsPerType;
+
+    // positions follow a random walk over neighbouring cells, like the gravity and runoff walks do
+    Random positionRandom(config.seed + 4);
+    std::vector<Vec2i> positions(count);
+    Vec2i pos(size / 2, size / 2);
+    for (auto& walkPos : positions)
+    {
+        const Vec2i nextPos = pos + cardinalDirections[(int)(positionRandom.nextDouble() * cardinalDirections.size())];
+        if (nextPos.x >= 0 && nextPos.x < size && nextPos.y >= 0 && nextPos.y < size)
+        {
+            pos = nextPos;
+        }
+        walkPos = pos;
+    }
+
+    volatile float sink = 0.f;
+    auto time = [&](const char* variant, TerrainLayer topLayer, auto&& elevation)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        float sum = 0.f;
+        for (int repeat = 0; repeat < numRepeats; ++repeat)
+        {
+            for (const auto& pos : positions)
+            {
+                sum += elevation(pos);
+            }
+        }
+        const double seconds = secondsSince(start);
+        sink = sink + sum;
+
+        char extraJson[128];
+        std::snprintf(extraJson, sizeof(extraJson), ",\"variant\":\"%s\",\"top_layer\":\"%s\"",
+            variant, terrainLayerNames[(int)topLayer].c_str());
+        report(config, "elevation", terrain, size, 1, (uint64_t)count * numRepeats, seconds, extraJson);
+    };
+
+    auto benchLayer = [&](auto layer)
+    {
+        constexpr TerrainLayer topLayer = decltype(layer)::value;
+        // read through a volatile so the compiler can't treat the runtime variants as constant
+        volatile TerrainLayer opaqueTopLayer = topLayer;
+        const TerrainLayer runtimeTopLayer = opaqueTopLayer;
+        time("loop", topLayer, [&](const Vec2i& pos)
+        {
+            float elevation = 0.f;
+            for (int terrainLayerIdx = 0; terrainLayerIdx <= (int)runtimeTopLayer; ++terrainLayerIdx)
+            {
+                elevation += simulation.getLayerValue(pos.x, pos.y, (TerrainLayer)terrainLayerIdx);
+            }
+            return elevation;
+        });
+        time("dispatched", topLayer, [&](const Vec2i& pos) { return simulation.calculateElevation(pos, runtimeTopLayer); });
+        time("specialized", topLayer, [&](const Vec2i& pos) { return simulation.calculateElevation<topLayer>(pos); });
+    };
+    benchLayer(std::integral_constant<TerrainLayer, TerrainLayer::ROCK>());
+    benchLayer(std::integral_constant<TerrainLayer, TerrainLayer::SAND>());
+    benchLayer(std::integral_constant<TerrainLayer, TerrainLayer::HUMUS>());
+}
+
+// runoff and gravity walks with 4- and 8-neighbour descent on the same positions, each from a copy of the same terrain;
+// mean path length needs a stats build
+void benchDescent(const BenchConfig& config, const std::string& terrain, int size, const TerrainSimulation& simulation)
+{
+    for (int descentModeIdx = 0; descentModeIdx < numDescentModes; ++descentModeIdx)
+    {
+        for (Event event : { Event::RUNOFF, Event::GRAVITY })
+        {
+            auto descentSimulation = std::make_unique<TerrainSimulation>(simulation);
+            SimulationParams params = descentSimulation->getParams();
+            params.descentMode = (DescentMode)descentModeIdx;
+            descentSimulation->setParams(params);
+            descentSimulation->resetStats();
+
+            const double seconds = timeEvents(*descentSimulation,
+                [&](int x, int y) { descentSimulation->simulateEvent(x, y, event); }, config.eventsPerType, config.seed + 5);
+
+            char extraJson[128];
+            int extraLength = std::snprintf(extraJson, sizeof(extraJson), ",\"descent\":\"%s\",\"event\":\"%s\"",
+                descentModeNames[descentModeIdx].c_str(), eventNames[(int)event].c_str());
+            if (SimulationStats::enabled)
+            {
+                std::snprintf(extraJson + extraLength, sizeof(extraJson) - extraLength, ",\"mean_path_length\":%.3f",
+                    descentSimulation->getStats().events[(int)event].getMeanPathLength());
+            }
+            report(config, "descent", terrain, size, 1, config.eventsPerType, seconds, extraJson);
+        }
+    }
+}
+
+// a check as much as a timing: on a plane sloping down towards row 0, with 8-neighbour descent and a clamped border,
+// runoff walks start in row 1 and are handed off as soon as they step into row 0, which is left unowned. away from the
+// edge a walk goes straight with weight 1 or diagonally with 1 / sqrt(2) to either side; in the edge column only the
+// straight and the inward step exist, and they have to keep the same odds. returns false, after reporting, if the edge
+// steps outward or its odds differ from the middle column's by more than 5 standard deviations. items are walks
+bool benchEdgeFlow(const BenchConfig& config)
+{
+    constexpr int size = 16;
+    constexpr int numWalks = 20000;
+    const int startXs[] = { 0, size / 2 };
+
+    TerrainSimulation simulation;
+    simulation.setTerrainSize(size, 2, 1.f);
+    SimulationParams params;
+    params.boundaryMode = BoundaryMode::CLAMP;
+    params.descentMode = DescentMode::D8;
+    simulation.setParams(params);
+    simulation.setOwnedRows(1, 2);
+    simulation.setSeed(config.seed + 6);
+
+    // steps to the left, straight down and to the right, from the edge column and from the middle one
+    std::array<std::array<uint64_t, 3>, 2> stepCounts{};
+    std::vector<float> bedrockRow(size);
+    const auto start = std::chrono::steady_clock::now();
+    for (int walkIdx = 0; walkIdx < numWalks; ++walkIdx)
+    {
+        for (int startIdx = 0; startIdx < 2; ++startIdx)
+        {
+            // the walk erodes where it starts, so the plane is laid down again each time
+            for (int terrainLayerIdx = 1; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+            {
+                simulation.clearLayer((TerrainLayer)terrainLayerIdx);
+            }
+            for (int y = 0; y < 2; ++y)
+            {
+                std::fill(bedrockRow.begin(), bedrockRow.end(), (float)y);
+                simulation.writeLayerRow(TerrainLayer::BEDROCK, 0, y, size, bedrockRow.data());
+            }
+            simulation.updateGhostCells();
+
+            simulation.simulateEvent(startXs[startIdx], 1, Event::RUNOFF);
+            for (const WalkState& walk : simulation.takeHandedOffWalks())
+            {
+                ++stepCounts[startIdx][std::clamp(walk.pos.x - startXs[startIdx], -1, 1) + 1];
+            }
+        }
+    }
+    const double seconds = secondsSince(start);
+
+    // odds of going straight rather than inward (to the right); the middle column's leftward steps don't count
+    const double edgeInward = (double)(stepCounts[0][1] + stepCounts[0][2]);
+    const double middleInward = (double)(stepCounts[1][1] + stepCounts[1][2]);
+    const double edgeStraight = stepCounts[0][1] / std::max(edgeInward, 1.0);
+    const double middleStraight = stepCounts[1][1] / std::max(middleInward, 1.0);
+    const double pooledStraight = (stepCounts[0][1] + stepCounts[1][1]) / std::max(edgeInward + middleInward, 1.0);
+    const double standardError = std::sqrt(pooledStraight * (1.0 - pooledStraight)
+        * (1.0 / std::max(edgeInward, 1.0) + 1.0 / std::max(middleInward, 1.0)));
+    const bool consistent = stepCounts[0][0] == 0 && std::abs(edgeStraight - middleStraight) <= 5.0 * standardError;
+
+    char extraJson[192];
+    std::snprintf(extraJson, sizeof(extraJson),
+        ",\"descent\":\"d8\",\"boundary\":\"clamp\",\"edge_outward\":%llu,\"edge_straight\":%.4f,\"middle_straight\":%.4f,"
+        "\"consistent\":%s", (unsigned long long)stepCounts[0][0], edgeStraight, middleStraight, consistent ? "true" : "false");
+    report(config, "edge_flow", "plane", size, 1, 2 * (uint64_t)numWalks, seconds, extraJson);
+    if (!consistent)
+    {
+        std::fprintf(stderr, "edge_flow: walks along a clamped edge don't step like the ones away from it\n");
+    }
+    return consistent;
+}
+
+// one year from the same terrain with several seeds. height_seed_std is the per-cell standard deviation of the
+// resulting height across seeds, averaged over cells: the noise a single run carries. averaging k runs divides it by
+// sqrt(k), so a scheme that lowers it by a ratio r is worth about 1 / r^2 times the events
+void benchSeedNoise(const BenchConfig& config, const std::string& terrain, int size, const TerrainSimulation& simulation)
+{
+    static constexpr int numSeeds = 4;
+    const size_t numCells = (size_t)size * size;
+    ThreadPool& pool = ThreadPool::getShared();
+
+    std::vector<double> heightSum(numCells);
+    std::vector<double> heightSquaredSum(numCells);
+    std::vector<float> heightOut(numCells);
+    double seconds = 0.0;
+
+    for (int seedIdx = 0; seedIdx < numSeeds; ++seedIdx)
+    {
+        auto seedSimulation = std::make_unique<TerrainSimulation>(simulation);
+        seedSimulation->setSeed(config.seed + 100 + seedIdx);
+
+        const auto start = std::chrono::steady_clock::now();
+        seedSimulation->stepSimulation();
+        seconds += secondsSince(start);
+
+        seedSimulation->writeSurface(pool, heightOut.data(), {});
+        for (size_t cellIdx = 0; cellIdx < numCells; ++cellIdx)
+        {
+            heightSum[cellIdx] += heightOut[cellIdx];
+            heightSquaredSum[cellIdx] += (double)heightOut[cellIdx] * heightOut[cellIdx];
+        }
+    }
+
+    double stdSum = 0.0;
+    for (size_t cellIdx = 0; cellIdx < numCells; ++cellIdx)
+    {
+        const double mean = heightSum[cellIdx] / numSeeds;
+        const double variance = (heightSquaredSum[cellIdx] - numSeeds * mean * mean) / (numSeeds - 1);
+        stdSum += std::sqrt(std::max(variance, 0.0));
+    }
+
+    char extraJson[64];
+    std::snprintf(extraJson, sizeof(extraJson), ",\"height_seed_std\":%.6f", stdSum / numCells);
+    report(config, "seed_noise", terrain, size, 1, (uint64_t)numSeeds * numCells * numEvents, seconds, extraJson);
+}
+
+// the largest thread count with the layer pages on the sizing thread's node or spread over all nodes, with and without
+// pinned workers. each combination sets up a fresh terrain on its own pool, then times a hogwild year (up to
+// --year-max-size) and the output pass. on a single-node machine all four should match
+void benchNuma(const BenchConfig& config, const std::string& terrain, int size)
+{
+    const int threads = *std::max_element(config.threadCounts.begin(), config.threadCounts.end());
+    const uint64_t numCells = (uint64_t)size * size;
+    std::vector<float> heightOut(numCells);
+
+    for (int placementIdx = 0; placementIdx < numMemoryPlacements; ++placementIdx)
+    {
+        for (bool pinThreads : { false, true })
+        {
+            ThreadPool pool(threads, pinThreads);
+            auto simulation = std::make_unique<TerrainSimulation>();
+            simulation->setTerrainSize(size, size, 1.f, &pool, (MemoryPlacement)placementIdx);
+            simulation->setSeed(config.seed);
+            generateTerrain(terrain, size, config.seed, *simulation, pool);
+            simulation->initializeHumusFromBedrock(pool);
+
+            char extraJson[128];
+            std::snprintf(extraJson, sizeof(extraJson), ",\"placement\":\"%s\",\"pinned\":%s,\"numa_nodes\":%d",
+                memoryPlacementNames[placementIdx].c_str(), pinThreads ? "true" : "false", getNumaNodeCount());
+
+            if (size <= config.yearMaxSize)
+            {
+                SimulationParams params = simulation->getParams();
+                params.executionMode = ExecutionMode::HOGWILD;
+                simulation->setParams(params);
+
+                const auto start = std::chrono::steady_clock::now();
+                simulation->stepSimulation(nullptr, &pool);
+                report(config, "numa_year_step", terrain, size, threads, numCells * numEvents, secondsSince(start), extraJson);
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            simulation->writeSurface(pool, heightOut.data(), {});
+            report(config, "numa_output_conversion", terrain, size, threads, numCells, secondsSince(start), extraJson);
+        }
+    }
+}
+
+// sizing the layers at the largest thread count: into a new buffer, again at the same size (reusing it), and again
+// without clearing, as when every layer is about to be read from an input. items are cells
+void benchSetup(const BenchConfig& config, const std::string& terrain, int size)
+{
+    const int threads = *std::max_element(config.threadCounts.begin(), config.threadCounts.end());
+    ThreadPool pool(threads);
+    TerrainSimulation simulation;
+
+    const char* setups[] = { "new", "reused", "reused_uncleared" };
+    for (int setupIdx = 0; setupIdx < 3; ++setupIdx)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        simulation.setTerrainSize(size, size, 1.f, &pool, MemoryPlacement::SPREAD, setupIdx < 2);
+        const double seconds = secondsSince(start);
+
+        char extraJson[64];
+        std::snprintf(extraJson, sizeof(extraJson), ",\"setup\":\"%s\"", setups[setupIdx]);
+        report(config, "terrain_setup", terrain, size, threads, (uint64_t)size * size, seconds, extraJson);
+    }
+}
+
+// one serial year run on a proxy at 1 / scale resolution, including downsampling the layers and upsampling the change
+// back; items are full-resolution cells. runs wherever the proxy fits within --year-max-size, so the largest sizes get
+// a preview time even where a full year is skipped
+void benchPreview(const BenchConfig& config, const std::string& terrain, int size, const TerrainSimulation& simulation)
+{
+    for (int scale : { 2, 4, 8 })
+    {
+        if (size / scale > config.yearMaxSize || size / scale < 16)
+        {
+            continue;
+        }
+
+        auto outputSimulation = std::make_unique<TerrainSimulation>(simulation);
+        TerrainSimulation proxyInitial;
+        TerrainSimulation proxy;
+
+        const auto start = std::chrono::steady_clock::now();
+        proxyInitial.downsampleFrom(*outputSimulation, scale);
+        proxy.downsampleFrom(*outputSimulation, scale);
+        proxy.setSeed(config.seed);
+        proxy.stepSimulation();
+        outputSimulation->addUpsampledChange(proxyInitial, proxy, scale);
+        const double seconds = secondsSince(start);
+
+        char extraJson[64];
+        std::snprintf(extraJson, sizeof(extraJson), ",\"preview_scale\":%d", scale);
+        report(config, "preview_year", terrain, size, 1, (uint64_t)size * size, seconds, extraJson);
+    }
+}
+
+void runTerrain(const BenchConfig& config, const std::string& terrain, int size)
+{
+    benchSetup(config, terrain, size);
+
+    auto simulation = std::make_unique<TerrainSimulation>();
+    simulation->setTerrainSize(size, size, 1.f);
+    simulation->setSeed(config.seed);
+
+    ThreadPool& sharedPool = ThreadPool::getShared();
+    generateTerrain(terrain, size, config.seed, *simulation, sharedPool);
+
+    const uint64_t numCells = (uint64_t)size * size;
+
+    // input conversion: humus initialization from bedrock slope
+    for (int threads : config.threadCounts)
+    {
+        ThreadPool pool(threads);
+        const auto start = std::chrono::steady_clock::now();
+        simulation->initializeHumusFromBedrock(pool);
+        report(config, "input_conversion", terrain, size, threads, numCells, secondsSince(start));
+    }
+
+    benchElevation(config, terrain, size, *simulation);
+
+    // per-event throughput; the simulation itself is serial, so these run on the calling thread. events change the
+    // terrain, so every benchmark from here on runs on its own copy of it and none depends on what ran before
+    {
+        auto eventSimulation = std::make_unique<TerrainSimulation>(*simulation);
+        report(config, "runoff_event", terrain, size, 1, config.eventsPerType,
+            timeEvents(*eventSimulation, [&](int x, int y) { eventSimulation->simulateRunoffEvent(x, y); }, config.eventsPerType, config.seed + 1));
+    }
+    {
+        auto eventSimulation = std::make_unique<TerrainSimulation>(*simulation);
+        report(config, "gravity_event", terrain, size, 1, config.eventsPerType,
+            timeEvents(*eventSimulation, [&](int x, int y) { eventSimulation->simulateGravityEvent(x, y); }, config.eventsPerType, config.seed + 2));
+    }
+    {
+        auto eventSimulation = std::make_unique<TerrainSimulation>(*simulation);
+        report(config, "lightning_event", terrain, size, 1, config.eventsPerType,
+            timeEvents(*eventSimulation, [&](int x, int y) { eventSimulation->simulateLightningEvent(x, y); }, config.eventsPerType, config.seed + 3));
+    }
+
+    // each event order steps a copy of the same terrain
+    if (size <= config.yearMaxSize)
+    {
+        for (int eventOrderIdx = 0; eventOrderIdx < numEventOrders; ++eventOrderIdx)
+        {
+            auto yearSimulation = std::make_unique<TerrainSimulation>(*simulation);
+            SimulationParams params = yearSimulation->getParams();
+            params.eventOrder = (EventOrder)eventOrderIdx;
+            yearSimulation->setParams(params);
+
+            const auto start = std::chrono::steady_clock::now();
+            yearSimulation->stepSimulation();
+            const double seconds = secondsSince(start);
+
+            char extraJson[96];
+            std::snprintf(extraJson, sizeof(extraJson), ",\"event_order\":\"%s\",\"execution\":\"serial\"",
+                eventOrderNames[eventOrderIdx].c_str());
+            report(config, "year_step", terrain, size, 1, numCells * numEvents, seconds, extraJson);
+        }
+
+        // the parallel execution modes at each thread count, with hogwild's drift from the expected mass at the end of
+        // the year
+        for (ExecutionMode executionMode : { ExecutionMode::HOGWILD, ExecutionMode::DEFERRED })
+        {
+            for (int threads : config.threadCounts)
+            {
+                ThreadPool pool(threads);
+                auto yearSimulation = std::make_unique<TerrainSimulation>(*simulation);
+                SimulationParams params = yearSimulation->getParams();
+                params.executionMode = executionMode;
+                yearSimulation->setParams(params);
+
+                const auto start = std::chrono::steady_clock::now();
+                yearSimulation->stepSimulation(nullptr, &pool);
+                const double seconds = secondsSince(start);
+
+                char extraJson[128];
+                std::snprintf(extraJson, sizeof(extraJson), ",\"event_order\":\"random\",\"execution\":\"%s\",\"mass_drift\":%g",
+                    executionModeNames[(int)executionMode].c_str(), yearSimulation->getLastMassDrift());
+                report(config, "year_step", terrain, size, threads, numCells * numEvents, seconds, extraJson);
+            }
+        }
+    }
+
+    if (size <= config.yearMaxSize)
+    {
+        benchSeedNoise(config, terrain, size, *simulation);
+    }
+    benchPreview(config, terrain, size, *simulation);
+
+    // output conversion: combined height and color planes
+    std::vector<float> heightOut(numCells);
+    std::array<std::vector<float>, 3> colorOut;
+    for (auto& channel : colorOut)
+    {
+        channel.resize(numCells);
+    }
+
+    for (int threads : config.threadCounts)
+    {
+        ThreadPool pool(threads);
+        const auto start = std::chrono::steady_clock::now();
+        simulation->writeSurface(pool, heightOut.data(), { colorOut[0].data(), colorOut[1].data(), colorOut[2].data() });
+        report(config, "output_conversion", terrain, size, threads, numCells, secondsSince(start));
+    }
+
+    benchNuma(config, terrain, size);
+    benchDescent(config, terrain, size, *simulation);
+}
+
+bool parseArgs(int argc, char** argv, BenchConfig* config)
+{
+    for (int argIdx = 1; argIdx < argc; ++argIdx)
+    {
+        const std::string arg = argv[argIdx];
+        if (argIdx + 1 >= argc)
+        {
+            std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return false;
+        }
+
+        const std::string value = argv[++argIdx];
+        if (arg == "--sizes")
+        {
+            config->sizes = splitIntList(value);
+        }
+        else if (arg == "--terrains")
+        {
+            config->terrains = splitList(value);
+        }
+        else if (arg == "--threads")
+        {
+            config->threadCounts = splitIntList(value);
+        }
+        else if (arg == "--events")
+        {
+            config->eventsPerType = std::atoi(value.c_str());
+        }
+        else if (arg == "--year-max-size")
+        {
+            config->yearMaxSize = std::atoi(value.c_str());
+        }
+        else if (arg == "--seed")
+        {
+            config->seed = std::atoi(value.c_str());
+        }
+        else if (arg == "--output")
+        {
+            config->output = std::fopen(value.c_str(), "w");
+            if (!config->output)
+            {
+                std::fprintf(stderr, "could not open %s\n", value.c_str());
+                return false;
+            }
+        }
+        else
+        {
+            std::fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (config->threadCounts.empty())
+    {
+        // powers of two up to the hardware thread count
+        const int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+        {
+            config->threadCounts.push_back(threads);
+        }
+        config->threadCounts.push_back(maxThreads);
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if (!parseArgs(argc, argv, &config))
+    {
+        return 1;
+    }
+
+    const bool edgeFlowConsistent = benchEdgeFlow(config);
+
+    for (const auto& terrain : config.terrains)
+    {
+        for (int size : config.sizes)
+        {
+            runTerrain(config, terrain, size);
+        }
+    }
+
+    if (config.output != stdout)
+    {
+        std::fclose(config.output);
+    }
+    return edgeFlowConsistent ? 0 : 1;
+}
@@ -0,0 +1,584 @@
+#include "daemon.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "heightfield_io.hpp"
+#include "shared_memory.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define TERRABLE_HAS_DAEMON
+#endif
+
+using namespace Terrable;
+
+#ifdef TERRABLE_HAS_DAEMON
+
+// protocol: the client creates a shared memory object holding width * height input heights (already scaled) followed
+// by room for every requested output plane, and sends one line
+//   run <shared memory name> <width> <height> <getSimulationArgs options> --outputs <list>
+// the daemon maps the object, removes its name, fills the output planes in place and replies with one line
+//   ok <years simulated> <years resumed from the cache> <seconds>   or   error <message>
+// the client may send any line (or hang up) while waiting, which stops the job at its next progress check; a stopped
+// job still fills the outputs with the terrain reached so far
+
+namespace
+{
+
+constexpr int pollIntervalMs = 100;
+
+// clients name their shared memory <prefix><pid>-<counter>, and the daemon opens and unlinks nothing else, so a request
+// can't point it at another program's objects
+constexpr const char* memoryNamePrefix = "/terrable-";
+
+bool isClientMemoryName(const std::string& name)
+{
+    const size_t prefixLength = std::strlen(memoryNamePrefix);
+    if (name.compare(0, prefixLength, memoryNamePrefix) != 0)
+    {
+        return false;
+    }
+
+    // two runs of digits separated by one dash
+    const size_t dash = name.find('-', prefixLength);
+    auto isDigits = [&](size_t begin, size_t end)
+    {
+        return begin < end && std::all_of(name.begin() + begin, name.begin() + end, [](char c) { return c >= '0' && c <= '9'; });
+    };
+    return dash != std::string::npos && isDigits(prefixLength, dash) && isDigits(dash + 1, name.size());
+}
+
+// a prepared initial terrain (0 years) or the stepped terrain of a finished run, keyed by everything that decided it
+class SimulationCache
+{
+public:
+    explicit SimulationCache(size_t maxBytes)
+        : maxBytes(maxBytes)
+    {
+    }
+
+    // the entry for key with the most years up to maxYears, or null; marks it as recently used
+    std::shared_ptr<const TerrainSimulation> find(const std::string& key, int maxYears, int* years)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto bestIt = entries.end();
+        for (auto entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+        {
+            if (entryIt->key == key && entryIt->years <= maxYears && (bestIt == entries.end() || entryIt->years > bestIt->years))
+            {
+                bestIt = entryIt;
+            }
+        }
+        if (bestIt == entries.end())
+        {
+            return nullptr;
+        }
+
+        entries.splice(entries.begin(), entries, bestIt);
+        *years = bestIt->years;
+        return bestIt->simulation;
+    }
+
+    // evicts the least recently used entries until the new one fits; one that doesn't fit on its own isn't kept
+    void insert(const std::string& key, int years, std::shared_ptr<const TerrainSimulation> simulation)
+    {
+        const size_t bytes = (size_t)(simulation->getWidth() + 2) * (simulation->getHeight() + 2) * numTerrainLayers * sizeof(float);
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.remove_if([&](const Entry& entry)
+        {
+            const bool replaced = entry.key == key && entry.years == years;
+            usedBytes -= replaced ? entry.bytes : 0;
+            return replaced;
+        });
+        if (bytes > maxBytes)
+        {
+            return;
+        }
+        while (usedBytes + bytes > maxBytes)
+        {
+            usedBytes -= entries.back().bytes;
+            entries.pop_back();
+        }
+        entries.push_front({ key, years, std::move(simulation), bytes });
+        usedBytes += bytes;
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        int years;
+        std::shared_ptr<const TerrainSimulation> simulation;
+        size_t bytes;
+    };
+
+    std::mutex mutex;
+    std::list<Entry> entries; // most recently used first
+    size_t maxBytes;
+    size_t usedBytes = 0;
+};
+
+// FNV-1a over the values' bits, so identical inputs from different clients share cache entries
+uint64_t hashValues(const float* values, size_t count)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        hash = (hash ^ bits) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string joinArgs(const std::vector<std::string>& args, char separator)
+{
+    std::string joined;
+    for (const auto& arg : args)
+    {
+        joined += (joined.empty() ? "" : std::string(1, separator)) + arg;
+    }
+    return joined;
+}
+
+bool writeLine(int fd, const std::string& line)
+{
+    const std::string message = line + "\n";
+    for (size_t written = 0; written < message.size();)
+    {
+        const ssize_t count = write(fd, message.data() + written, message.size() - written);
+        if (count <= 0)
+        {
+            return false;
+        }
+        written += (size_t)count;
+    }
+    return true;
+}
+
+// reads up to the next newline, calling onWait every pollIntervalMs while nothing arrives; fails when the peer hangs
+// up or onWait returns false
+bool readLine(int fd, std::string* line, const std::function<bool()>& onWait)
+{
+    line->clear();
+    while (true)
+    {
+        pollfd pollFd = { fd, POLLIN, 0 };
+        if (poll(&pollFd, 1, pollIntervalMs) <= 0)
+        {
+            if (!onWait())
+            {
+                return false;
+            }
+            continue;
+        }
+
+        char c;
+        if (read(fd, &c, 1) != 1)
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            return true;
+        }
+        *line += c;
+    }
+}
+
+bool getSocketAddress(const std::string& socketPath, sockaddr_un* address, std::string* error)
+{
+    std::memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address->sun_path))
+    {
+        *error = "socket path too long: " + socketPath;
+        return false;
+    }
+    std::strcpy(address->sun_path, socketPath.c_str());
+    return true;
+}
+
+int connectSocket(const std::string& socketPath, std::string* error)
+{
+    sockaddr_un address;
+    if (!getSocketAddress(socketPath, &address, error))
+    {
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) != 0)
+    {
+        *error = "could not connect to daemon at " + socketPath + ": " + std::strerror(errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// runs one request; returns the reply
+std::string serveRequest(int fd, const std::string& request, SimulationCache& cache, ThreadPool& pool)
+{
+    std::istringstream stream(request);
+    std::string command;
+    std::string memoryName;
+    int width = 0;
+    int height = 0;
+    stream >> command >> memoryName >> width >> height;
+    if (command != "run" || !stream || width <= 0 || height <= 0)
+    {
+        return "error invalid request";
+    }
+    if (!isClientMemoryName(memoryName))
+    {
+        return "error invalid shared memory name " + memoryName;
+    }
+
+    std::vector<std::string> args;
+    std::string arg;
+    while (stream >> arg)
+    {
+        args.push_back(arg);
+    }
+
+    Job job;
+    std::string error;
+    if (!parseJobArgs(args, &job, nullptr, &error))
+    {
+        return "error " + error;
+    }
+    job.input = memoryName;
+
+    size_t numPlanes = 1;
+    for (const auto& outputName : job.outputs)
+    {
+        if (getOutputPlaneCount(outputName) == 0)
+        {
+            return "error unknown output " + outputName;
+        }
+        numPlanes += getOutputPlaneCount(outputName);
+    }
+
+    SharedMemory memory;
+    if (!memory.open(memoryName, &error))
+    {
+        return "error " + error;
+    }
+    // both sides keep their mappings, so the name can go now; nothing is left behind if the client dies mid-job
+    memory.unlink();
+    const size_t numCells = (size_t)width * height;
+    if (memory.getSize() < numPlanes * numCells * sizeof(float))
+    {
+        return "error shared memory " + memoryName + " is too small";
+    }
+
+    TERRABLE_TRACE_SCOPE("daemon job");
+    const auto start = std::chrono::steady_clock::now();
+
+    // humus depends on the cell size and boundary as well as the heights; params and seed are set again on every copy
+    const float* heights = memory.getFloats();
+    char inputKey[128];
+    std::snprintf(inputKey, sizeof(inputKey), "%016llx %dx%d %.9g %s", (unsigned long long)hashValues(heights, numCells),
+        width, height, job.cellSize, boundaryModeNames[(int)job.params.boundaryMode].c_str());
+
+    int cachedYears = 0;
+    std::shared_ptr<const TerrainSimulation> initial = cache.find(inputKey, 0, &cachedYears);
+    if (!initial)
+    {
+        auto prepared = std::make_shared<TerrainSimulation>();
+        setUpSimulation(job, width, height, heights, pool, prepared.get());
+        initial = prepared;
+        cache.insert(inputKey, 0, initial);
+    }
+
+    TerrainSimulation simulation(*initial);
+    simulation.setParams(job.params);
+    simulation.setSeed(job.seed);
+
+    TerrainSimulation proxyInitial;
+    TerrainSimulation proxy;
+    if (job.previewScale > 1)
+    {
+        proxyInitial.downsampleFrom(simulation, job.previewScale, &pool);
+        proxy.downsampleFrom(simulation, job.previewScale, &pool);
+        proxy.setSeed(job.seed);
+    }
+    TerrainSimulation& steppedSimulation = job.previewScale > 1 ? proxy : simulation;
+
+    // runs of the same simulation differ only in their years, so the longest cached one that isn't too long is resumed
+    Job runKeyJob = job;
+    runKeyJob.years = 0;
+    const std::string runKey = std::string(inputKey) + " " + joinArgs(getSimulationArgs(runKeyJob), ' ');
+    int resumedYears = 0;
+    if (auto checkpoint = cache.find(runKey, job.years, &resumedYears))
+    {
+        steppedSimulation = *checkpoint;
+    }
+
+    const int yearsSimulated = simulateYears(job, steppedSimulation, resumedYears, pool, [&]()
+    {
+        pollfd pollFd = { fd, POLLIN, 0 };
+        return poll(&pollFd, 1, 0) == 0;
+    });
+    if (yearsSimulated == job.years && yearsSimulated > resumedYears)
+    {
+        cache.insert(runKey, yearsSimulated, std::make_shared<const TerrainSimulation>(steppedSimulation));
+    }
+
+    if (job.previewScale > 1)
+    {
+        simulation.addUpsampledChange(proxyInitial, proxy, job.previewScale, &pool);
+    }
+
+    float* out = memory.getFloats() + numCells;
+    for (const auto& outputName : job.outputs)
+    {
+        extractOutput(simulation, outputName, out, pool);
+        out += numCells * getOutputPlaneCount(outputName);
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    logMessage("%s: %d years, %d of them from the cache, in %.2f s", memoryName.c_str(), yearsSimulated, resumedYears, seconds);
+    char reply[64];
+    std::snprintf(reply, sizeof(reply), "ok %d %d %.3f", yearsSimulated, resumedYears, seconds);
+    return reply;
+}
+
+} // namespace
+
+bool Terrable::serveDaemon(const std::string& socketPath, size_t cacheBytes, ThreadPool& pool, std::string* error)
+{
+    // a client that hangs up shouldn't take the daemon down with it when the reply is written
+    std::signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    if (!getSocketAddress(socketPath, &address, error))
+    {
+        return false;
+    }
+
+    // a socket file nobody answers on is left over from a daemon that didn't shut down cleanly
+    std::string connectError;
+    const int existingFd = connectSocket(socketPath, &connectError);
+    if (existingFd >= 0)
+    {
+        close(existingFd);
+        *error = "a daemon is already serving " + socketPath;
+        return false;
+    }
+    unlink(socketPath.c_str());
+
+    // only this user may connect, since a request makes the daemon map and unlink shared memory. nobody can connect
+    // before listen, so tightening the permissions in between leaves no window
+    const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0
+        || chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listenFd, 16) != 0)
+    {
+        *error = "could not listen on " + socketPath + ": " + std::strerror(errno);
+        if (listenFd >= 0)
+        {
+            close(listenFd);
+        }
+        return false;
+    }
+
+    logMessage("serving on %s with %d threads", socketPath.c_str(), pool.getNumThreads());
+
+    SimulationCache cache(cacheBytes);
+    std::atomic<int> numConnections(0);
+    while (interruptRequested == 0)
+    {
+        pollfd pollFd = { listenFd, POLLIN, 0 };
+        if (poll(&pollFd, 1, pollIntervalMs) <= 0)
+        {
+            continue;
+        }
+
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        ++numConnections;
+        std::thread([fd, &cache, &pool, &numConnections]()
+        {
+            std::string request;
+            if (readLine(fd, &request, []() { return interruptRequested == 0; }))
+            {
+                writeLine(fd, serveRequest(fd, request, cache, pool));
+            }
+            close(fd);
+            --numConnections;
+        }).detach();
+    }
+
+    // running jobs see the interrupt too and reply with what they have
+    close(listenFd);
+    unlink(socketPath.c_str());
+    while (numConnections > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+bool Terrable::runDaemonJob(const Job& job, const std::string& socketPath, std::string* error)
+{
+    if (job.input.empty())
+    {
+        *error = "no input given";
+        return false;
+    }
+
+    if (!job.statsJson.empty())
+    {
+        *error = "--stats-json isn't supported with --daemon";
+        return false;
+    }
+
+    if (job.processes > 1)
+    {
+        *error = "--processes isn't supported with --daemon";
+        return false;
+    }
+
+    if (!job.variants.empty() || !job.seeds.empty())
+    {
+        *error = "--variants and --seeds aren't supported with --daemon";
+        return false;
+    }
+
+    Job daemonJob = job;
+    daemonJob.outputs = getOutputNames(job);
+    size_t numPlanes = 1;
+    for (const auto& outputName : daemonJob.outputs)
+    {
+        if (getOutputPlaneCount(outputName) == 0)
+        {
+            *error = "unknown output " + outputName;
+            return false;
+        }
+        numPlanes += getOutputPlaneCount(outputName);
+    }
+
+    Heightfield input;
+    if (!readHeightfield(job.input, &input, error, job.rawWidth, job.rawHeight))
+    {
+        return false;
+    }
+
+    static std::atomic<int> numMemories(0);
+    const std::string memoryName = memoryNamePrefix + std::to_string(getpid()) + "-" + std::to_string(numMemories++);
+    const size_t numCells = (size_t)input.width * input.height;
+    SharedMemory memory;
+    if (!memory.create(memoryName, numPlanes * numCells * sizeof(float), error))
+    {
+        return false;
+    }
+    std::transform(input.values.begin(), input.values.end(), memory.getFloats(), [&](float value) { return value * job.heightScale; });
+    input.values = std::vector<float>();
+
+    std::string reply;
+    const int fd = connectSocket(socketPath, error);
+    if (fd >= 0)
+    {
+        std::signal(SIGPIPE, SIG_IGN);
+        const std::string request = "run " + memoryName + " " + std::to_string(input.width) + " " + std::to_string(input.height) +
+            " " + joinArgs(getSimulationArgs(daemonJob), ' ') + " --outputs " + joinArgs(daemonJob.outputs, ',');
+
+        // on Ctrl-C, ask the daemon to stop and still wait for the partial result
+        bool cancelSent = false;
+        if (!writeLine(fd, request) || !readLine(fd, &reply, [&]()
+        {
+            if (interruptRequested != 0 && !cancelSent)
+            {
+                cancelSent = writeLine(fd, "cancel");
+            }
+            return true;
+        }))
+        {
+            *error = "lost connection to daemon at " + socketPath;
+        }
+        close(fd);
+    }
+    // the daemon unlinks the name when it opens the memory, unless it never got that far
+    memory.unlink();
+
+    if (reply.compare(0, 6, "error ") == 0)
+    {
+        *error = reply.substr(6);
+        return false;
+    }
+
+    int yearsSimulated = 0;
+    int resumedYears = 0;
+    if (std::sscanf(reply.c_str(), "ok %d %d", &yearsSimulated, &resumedYears) != 2)
+    {
+        if (error->empty())
+        {
+            *error = "invalid reply from daemon: " + reply;
+        }
+        return false;
+    }
+
+    if (resumedYears > 0)
+    {
+        logMessage("%s: resumed from %d cached years", job.input.c_str(), resumedYears);
+    }
+    if (yearsSimulated < job.years)
+    {
+        logMessage("%s: interrupted during year %d, writing partial result", job.input.c_str(), yearsSimulated);
+    }
+
+    const float* values = memory.getFloats() + numCells;
+    for (const auto& outputName : daemonJob.outputs)
+    {
+        if (!writeOutput(job, outputName, input.width, input.height, values, error))
+        {
+            return false;
+        }
+        values += numCells * getOutputPlaneCount(outputName);
+    }
+    return true;
+}
+
+#else
+
+bool Terrable::serveDaemon(const std::string&, size_t, ThreadPool&, std::string* error)
+{
+    *error = "the daemon needs Unix sockets and POSIX shared memory, which this system doesn't have";
+    return false;
+}
+
+bool Terrable::runDaemonJob(const Job&, const std::string&, std::string* error)
+{
+    *error = "the daemon needs Unix sockets and POSIX shared memory, which this system doesn't have";
+    return false;
+}
+
+#endif
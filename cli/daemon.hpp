@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "job.hpp"
+
+namespace Terrable
+{
+
+// serves simulation jobs from runDaemonJob clients on the Unix socket at socketPath until interrupted. each connection
+// runs on its own thread and its grid passes share pool. prepared inputs and finished runs are cached, up to about
+// cacheBytes of layers, so a repeated job resumes from the longest cached run of the same simulation
+bool serveDaemon(const std::string& socketPath, size_t cacheBytes, ThreadPool& pool, std::string* error);
+
+// runs job on the daemon serving socketPath, handing the input heights over and the outputs back through shared
+// memory, then writes the outputs like runJob
+bool runDaemonJob(const Job& job, const std::string& socketPath, std::string* error);
+
+} // namespace Terrable
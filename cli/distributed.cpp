@@ -0,0 +1,629 @@
+#include "distributed.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define TERRABLE_HAS_DISTRIBUTED
+#endif
+
+using namespace Terrable;
+
+#ifdef TERRABLE_HAS_DISTRIBUTED
+
+// the coordinator sends each worker a WorkerSetup message, then the layers of its rows (halo included) layer by layer, a
+// row at a time. at every sync point, each worker swaps one message with each neighbour: a SyncHeader, its owned row
+// next to their border (all layers), and the walks that stepped into their rows, with global row numbers. once done,
+// it sends the coordinator a WorkerResult and the layers of its owned rows. workers are started from the same
+// executable, so the structs go over the sockets as they are
+
+namespace
+{
+
+struct WorkerSetup
+{
+    int width;
+    int height; // rows held by the worker, halo included
+    int ownedRowBegin;
+    int ownedRowEnd;
+    int rowOffset; // global row of the worker's row 0, which wraps around with BoundaryMode::WRAP
+    int terrainHeight;
+    float cellSize;
+    SimulationParams params;
+    int seed;
+    int years;
+    int syncsPerYear;
+};
+
+struct SyncHeader
+{
+    int lastSync; // the sender stops after this sync, so walks sent to it are deposited rather than continued
+    int numWalks;
+};
+
+struct WorkerResult
+{
+    int yearsSimulated;
+    int64_t numWalksHandedOff;
+    double simulateSeconds;
+    double exchangeSeconds; // includes waiting for slower neighbours
+};
+
+bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t count = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+bool readAll(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t count = recv(fd, bytes, size, 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+template <typename T>
+void appendBytes(std::vector<char>* bytes, const T* values, size_t count)
+{
+    const char* begin = reinterpret_cast<const char*>(values);
+    bytes->insert(bytes->end(), begin, begin + count * sizeof(T));
+}
+
+// one message each way over a neighbour link, framed by its size
+struct Exchange
+{
+    int fd;
+    std::vector<char> out;
+    std::vector<char> in;
+    bool received = false;
+};
+
+// sends every link its message while receiving one from each, so neighbours that send to each other at the same time
+// can't both block on a full socket buffer. a link whose peer has gone is left with received false
+void exchangeMessages(std::vector<Exchange>& exchanges)
+{
+    struct Progress
+    {
+        std::vector<char> framed;
+        size_t sent = 0;
+        uint64_t inSize = 0;
+        size_t inHeaderRead = 0;
+        size_t inRead = 0;
+        bool failed = false;
+    };
+    std::vector<Progress> progress(exchanges.size());
+    for (size_t i = 0; i < exchanges.size(); ++i)
+    {
+        const uint64_t size = exchanges[i].out.size();
+        appendBytes(&progress[i].framed, &size, 1);
+        progress[i].framed.insert(progress[i].framed.end(), exchanges[i].out.begin(), exchanges[i].out.end());
+        exchanges[i].received = false;
+    }
+
+    while (true)
+    {
+        std::vector<pollfd> pollFds;
+        std::vector<size_t> pollExchanges;
+        for (size_t i = 0; i < exchanges.size(); ++i)
+        {
+            const Progress& state = progress[i];
+            const short events = (short)((state.sent < state.framed.size() ? POLLOUT : 0) | (exchanges[i].received ? 0 : POLLIN));
+            if (!state.failed && events != 0)
+            {
+                pollFds.push_back({ exchanges[i].fd, events, 0 });
+                pollExchanges.push_back(i);
+            }
+        }
+        if (pollFds.empty())
+        {
+            return;
+        }
+        if (poll(pollFds.data(), pollFds.size(), -1) < 0)
+        {
+            continue;
+        }
+
+        for (size_t pollIdx = 0; pollIdx < pollFds.size(); ++pollIdx)
+        {
+            Exchange& exchange = exchanges[pollExchanges[pollIdx]];
+            Progress& state = progress[pollExchanges[pollIdx]];
+            const short revents = pollFds[pollIdx].revents;
+            if ((revents & POLLOUT) && state.sent < state.framed.size())
+            {
+                const ssize_t count = send(exchange.fd, state.framed.data() + state.sent, state.framed.size() - state.sent,
+                    MSG_NOSIGNAL | MSG_DONTWAIT);
+                state.failed = count < 0 && errno != EAGAIN && errno != EINTR;
+                state.sent += count > 0 ? (size_t)count : 0;
+            }
+            if ((revents & (POLLIN | POLLHUP | POLLERR)) && !exchange.received && !state.failed)
+            {
+                const bool readingHeader = state.inHeaderRead < sizeof(state.inSize);
+                char* target = readingHeader ? reinterpret_cast<char*>(&state.inSize) + state.inHeaderRead : exchange.in.data() + state.inRead;
+                const size_t wanted = readingHeader ? sizeof(state.inSize) - state.inHeaderRead : exchange.in.size() - state.inRead;
+                const ssize_t count = wanted > 0 ? recv(exchange.fd, target, wanted, MSG_DONTWAIT) : 0;
+                if (wanted > 0 && count == 0)
+                {
+                    state.failed = true;
+                    continue;
+                }
+                state.failed = count < 0 && errno != EAGAIN && errno != EINTR;
+                const size_t numRead = count > 0 ? (size_t)count : 0;
+                if (readingHeader)
+                {
+                    state.inHeaderRead += numRead;
+                    if (state.inHeaderRead == sizeof(state.inSize))
+                    {
+                        exchange.in.resize(state.inSize);
+                    }
+                }
+                else
+                {
+                    state.inRead += numRead;
+                }
+                exchange.received = state.inHeaderRead == sizeof(state.inSize) && state.inRead == exchange.in.size();
+            }
+        }
+    }
+}
+
+// a neighbour's side of a worker: the halo row it fills and the owned row it is sent
+struct NeighbourLink
+{
+    int fd;
+    int haloRow;
+    int borderRow;
+};
+
+bool runWorker(int coordinatorFd, int upFd, int downFd)
+{
+    WorkerSetup setup;
+    if (!readAll(coordinatorFd, &setup, sizeof(setup)))
+    {
+        return false;
+    }
+
+    // the worker is one thread of the decomposition; parallel execution modes run on just this one
+    ThreadPool pool(1);
+    TerrainSimulation simulation;
+    simulation.setTerrainSize(setup.width, setup.height, setup.cellSize, &pool, MemoryPlacement::SPREAD, false);
+    std::vector<float> row(setup.width);
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+    {
+        for (int y = 0; y < setup.height; ++y)
+        {
+            if (!readAll(coordinatorFd, row.data(), row.size() * sizeof(float)))
+            {
+                return false;
+            }
+            simulation.writeLayerRow((TerrainLayer)terrainLayerIdx, 0, y, setup.width, row.data());
+        }
+    }
+    simulation.setParams(setup.params);
+    simulation.setSeed(setup.seed);
+    simulation.setOwnedRows(setup.ownedRowBegin, setup.ownedRowEnd);
+    simulation.updateGhostCells();
+
+    std::vector<NeighbourLink> links;
+    if (upFd >= 0)
+    {
+        links.push_back({ upFd, setup.ownedRowBegin - 1, setup.ownedRowBegin });
+    }
+    if (downFd >= 0)
+    {
+        links.push_back({ downFd, setup.ownedRowEnd, setup.ownedRowEnd - 1 });
+    }
+
+    auto toGlobalRow = [&](int y) { return ((y + setup.rowOffset) % setup.terrainHeight + setup.terrainHeight) % setup.terrainHeight; };
+    auto toLocalRow = [&](int y)
+    {
+        const int localY = ((y - setup.rowOffset) % setup.terrainHeight + setup.terrainHeight) % setup.terrainHeight;
+        return std::clamp(localY, setup.ownedRowBegin, setup.ownedRowEnd - 1);
+    };
+
+    WorkerResult result = {};
+    std::vector<Exchange> exchanges(links.size());
+    std::vector<float> borderValues((size_t)numTerrainLayers * setup.width);
+    bool stopping = false;
+    for (int year = 0; year < setup.years && !stopping; ++year)
+    {
+        TERRABLE_TRACE_SCOPE("year", "year", year);
+        bool yearDone = false;
+        for (int sync = 1; sync <= setup.syncsPerYear && !stopping; ++sync)
+        {
+            // every worker stops at the same fractions of its year, so they all reach each sync point together
+            const auto simulateStart = std::chrono::steady_clock::now();
+            const float syncProgress = (float)sync / setup.syncsPerYear;
+            bool interrupted = false;
+            if (!yearDone)
+            {
+                yearDone = simulation.stepSimulation([&](float yearProgress)
+                {
+                    interrupted = interruptRequested != 0;
+                    return !interrupted && (sync == setup.syncsPerYear || yearProgress < syncProgress);
+                }, &pool);
+            }
+            const auto exchangeStart = std::chrono::steady_clock::now();
+            result.simulateSeconds += std::chrono::duration<double>(exchangeStart - simulateStart).count();
+
+            const bool lastSync = interrupted || (year == setup.years - 1 && sync == setup.syncsPerYear);
+            const std::vector<WalkState> handedOff = simulation.takeHandedOffWalks();
+            result.numWalksHandedOff += (int64_t)handedOff.size();
+            for (size_t linkIdx = 0; linkIdx < links.size(); ++linkIdx)
+            {
+                const NeighbourLink& link = links[linkIdx];
+                std::vector<WalkState> walks;
+                for (WalkState walk : handedOff)
+                {
+                    if (walk.pos.y == link.haloRow)
+                    {
+                        walk.pos.y = toGlobalRow(walk.pos.y);
+                        walks.push_back(walk);
+                    }
+                }
+
+                for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+                {
+                    simulation.readLayerRow((TerrainLayer)terrainLayerIdx, 0, link.borderRow, setup.width,
+                        &borderValues[(size_t)terrainLayerIdx * setup.width]);
+                }
+
+                const SyncHeader header = { lastSync ? 1 : 0, (int)walks.size() };
+                std::vector<char>& out = exchanges[linkIdx].out;
+                out.clear();
+                appendBytes(&out, &header, 1);
+                appendBytes(&out, borderValues.data(), borderValues.size());
+                appendBytes(&out, walks.data(), walks.size());
+                exchanges[linkIdx].fd = link.fd;
+            }
+
+            exchangeMessages(exchanges);
+
+            // a neighbour that stopped, or is gone, ends the run here too; walks arriving now are left where they land
+            std::vector<WalkState> arrived;
+            stopping = lastSync;
+            for (size_t linkIdx = 0; linkIdx < links.size(); ++linkIdx)
+            {
+                const Exchange& exchange = exchanges[linkIdx];
+                SyncHeader header;
+                if (!exchange.received || exchange.in.size() < sizeof(header) + borderValues.size() * sizeof(float))
+                {
+                    stopping = true;
+                    continue;
+                }
+                std::memcpy(&header, exchange.in.data(), sizeof(header));
+                stopping = stopping || header.lastSync != 0;
+
+                const char* values = exchange.in.data() + sizeof(header);
+                std::memcpy(borderValues.data(), values, borderValues.size() * sizeof(float));
+                for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+                {
+                    simulation.writeLayerRow((TerrainLayer)terrainLayerIdx, 0, links[linkIdx].haloRow, setup.width,
+                        &borderValues[(size_t)terrainLayerIdx * setup.width]);
+                }
+
+                const char* walkBytes = values + borderValues.size() * sizeof(float);
+                const size_t numWalks = std::min((size_t)header.numWalks, (exchange.in.size() - (walkBytes - exchange.in.data())) / sizeof(WalkState));
+                for (size_t walkIdx = 0; walkIdx < numWalks; ++walkIdx)
+                {
+                    WalkState walk;
+                    std::memcpy(&walk, walkBytes + walkIdx * sizeof(WalkState), sizeof(walk));
+                    walk.pos.y = toLocalRow(walk.pos.y);
+                    arrived.push_back(walk);
+                }
+            }
+            simulation.updateGhostCells();
+
+            for (const auto& walk : arrived)
+            {
+                if (stopping)
+                {
+                    simulation.depositWalk(walk);
+                }
+                else
+                {
+                    simulation.continueWalk(walk);
+                }
+            }
+            result.exchangeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - exchangeStart).count();
+        }
+
+        if (yearDone)
+        {
+            ++result.yearsSimulated;
+        }
+    }
+
+    for (const auto& link : links)
+    {
+        close(link.fd);
+    }
+
+    if (!writeAll(coordinatorFd, &result, sizeof(result)))
+    {
+        return false;
+    }
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+    {
+        for (int y = setup.ownedRowBegin; y < setup.ownedRowEnd; ++y)
+        {
+            simulation.readLayerRow((TerrainLayer)terrainLayerIdx, 0, y, setup.width, row.data());
+            if (!writeAll(coordinatorFd, row.data(), row.size() * sizeof(float)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int Terrable::simulateDistributed(const Job& job, TerrainSimulation& steppedSimulation, std::string* error)
+{
+    const int numWorkers = job.processes;
+    const int width = steppedSimulation.getWidth();
+    const int height = steppedSimulation.getHeight();
+    if (height < numWorkers)
+    {
+        *error = "--processes " + std::to_string(numWorkers) + " needs at least as many rows";
+        return -1;
+    }
+
+    char executablePath[4096];
+    const ssize_t pathLength = readlink("/proc/self/exe", executablePath, sizeof(executablePath) - 1);
+    if (pathLength <= 0)
+    {
+        *error = "could not find the executable to start workers from";
+        return -1;
+    }
+    executablePath[pathLength] = '\0';
+
+    TERRABLE_TRACE_SCOPE("distributed years");
+
+    // edge e joins band e (its lower neighbour side) and band e + 1; with a wrapping boundary the last band's lower
+    // neighbour is the first band
+    const bool wraps = steppedSimulation.getParams().boundaryMode == BoundaryMode::WRAP;
+    const int numEdges = wraps ? numWorkers : numWorkers - 1;
+    std::vector<int> coordinatorFds(numWorkers, -1);
+    std::vector<std::array<int, 3>> workerFds(numWorkers, { -1, -1, -1 });
+    std::vector<int> openFds;
+    bool socketsCreated = true;
+    auto createPair = [&](int* first, int* second)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+        {
+            socketsCreated = false;
+            return;
+        }
+        openFds.push_back(fds[0]);
+        openFds.push_back(fds[1]);
+        *first = fds[0];
+        *second = fds[1];
+    };
+    for (int workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+    {
+        createPair(&coordinatorFds[workerIdx], &workerFds[workerIdx][0]);
+    }
+    for (int edgeIdx = 0; edgeIdx < numEdges; ++edgeIdx)
+    {
+        createPair(&workerFds[edgeIdx][2], &workerFds[(edgeIdx + 1) % numWorkers][1]);
+    }
+
+    auto closeAll = [&]()
+    {
+        for (int fd : openFds)
+        {
+            close(fd);
+        }
+        openFds.clear();
+    };
+    if (!socketsCreated)
+    {
+        closeAll();
+        *error = std::string("could not create worker sockets: ") + std::strerror(errno);
+        return -1;
+    }
+
+    // everything the children need is prepared before forking, since a child of a threaded process may only make
+    // async-signal-safe calls before exec
+    std::vector<std::vector<std::string>> workerArgStrings(numWorkers);
+    std::vector<std::vector<char*>> workerArgs(numWorkers);
+    for (int workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+    {
+        workerArgStrings[workerIdx] = { executablePath, "--worker", std::to_string(workerFds[workerIdx][0]),
+            std::to_string(workerFds[workerIdx][1]), std::to_string(workerFds[workerIdx][2]) };
+        for (auto& arg : workerArgStrings[workerIdx])
+        {
+            workerArgs[workerIdx].push_back(&arg[0]);
+        }
+        workerArgs[workerIdx].push_back(nullptr);
+    }
+
+    std::vector<pid_t> pids;
+    for (int workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+    {
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            for (int fd : workerFds[workerIdx])
+            {
+                if (fd >= 0)
+                {
+                    fcntl(fd, F_SETFD, 0);
+                }
+            }
+            execv(executablePath, workerArgs[workerIdx].data());
+            _exit(127);
+        }
+        if (pid > 0)
+        {
+            pids.push_back(pid);
+        }
+    }
+
+    // only the coordinator ends stay open here, so a worker that dies shows up as a closed socket
+    for (const auto& fds : workerFds)
+    {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+                openFds.erase(std::find(openFds.begin(), openFds.end(), fd));
+            }
+        }
+    }
+
+    bool succeeded = (int)pids.size() == numWorkers;
+    std::vector<int> rowBegins(numWorkers + 1);
+    for (int workerIdx = 0; workerIdx <= numWorkers; ++workerIdx)
+    {
+        rowBegins[workerIdx] = (int)((int64_t)height * workerIdx / numWorkers);
+    }
+
+    std::vector<float> row(width);
+    for (int workerIdx = 0; workerIdx < numWorkers && succeeded; ++workerIdx)
+    {
+        const bool hasUp = workerFds[workerIdx][1] >= 0;
+        const bool hasDown = workerFds[workerIdx][2] >= 0;
+        const int numOwnedRows = rowBegins[workerIdx + 1] - rowBegins[workerIdx];
+
+        WorkerSetup setup;
+        setup.width = width;
+        setup.height = numOwnedRows + (hasUp ? 1 : 0) + (hasDown ? 1 : 0);
+        setup.ownedRowBegin = hasUp ? 1 : 0;
+        setup.ownedRowEnd = setup.ownedRowBegin + numOwnedRows;
+        setup.rowOffset = rowBegins[workerIdx] - setup.ownedRowBegin;
+        setup.terrainHeight = height;
+        setup.cellSize = steppedSimulation.getCellSize();
+        setup.params = steppedSimulation.getParams();
+        setup.seed = job.seed * numWorkers + workerIdx;
+        setup.years = job.years;
+        setup.syncsPerYear = job.syncsPerYear;
+
+        const int fd = coordinatorFds[workerIdx];
+        succeeded = writeAll(fd, &setup, sizeof(setup));
+        for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers && succeeded; ++terrainLayerIdx)
+        {
+            for (int y = 0; y < setup.height && succeeded; ++y)
+            {
+                const int terrainY = ((setup.rowOffset + y) % height + height) % height;
+                steppedSimulation.readLayerRow((TerrainLayer)terrainLayerIdx, 0, terrainY, width, row.data());
+                succeeded = writeAll(fd, row.data(), row.size() * sizeof(float));
+            }
+        }
+    }
+
+    int yearsSimulated = job.years;
+    WorkerResult total = {};
+    double maxSimulateSeconds = 0.0;
+    double maxExchangeSeconds = 0.0;
+    for (int workerIdx = 0; workerIdx < numWorkers && succeeded; ++workerIdx)
+    {
+        const int fd = coordinatorFds[workerIdx];
+        WorkerResult result;
+        succeeded = readAll(fd, &result, sizeof(result));
+        for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers && succeeded; ++terrainLayerIdx)
+        {
+            for (int y = rowBegins[workerIdx]; y < rowBegins[workerIdx + 1] && succeeded; ++y)
+            {
+                succeeded = readAll(fd, row.data(), row.size() * sizeof(float));
+                steppedSimulation.writeLayerRow((TerrainLayer)terrainLayerIdx, 0, y, width, row.data());
+            }
+        }
+
+        yearsSimulated = std::min(yearsSimulated, result.yearsSimulated);
+        total.numWalksHandedOff += result.numWalksHandedOff;
+        maxSimulateSeconds = std::max(maxSimulateSeconds, result.simulateSeconds);
+        maxExchangeSeconds = std::max(maxExchangeSeconds, result.exchangeSeconds);
+    }
+
+    closeAll();
+    for (pid_t pid : pids)
+    {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    if (!succeeded)
+    {
+        *error = "a worker process failed";
+        return -1;
+    }
+
+    steppedSimulation.updateGhostCells();
+    logMessage("%s: %d processes, %lld walks crossed bands, simulating took up to %.2f s and syncing up to %.2f s per process",
+        job.input.c_str(), numWorkers, (long long)total.numWalksHandedOff, maxSimulateSeconds, maxExchangeSeconds);
+    return yearsSimulated;
+}
+
+int Terrable::runDistributedWorker(const std::vector<std::string>& args)
+{
+    if (args.size() != 3)
+    {
+        logMessage("--worker is only for processes started by --processes");
+        return 1;
+    }
+    return runWorker(std::atoi(args[0].c_str()), std::atoi(args[1].c_str()), std::atoi(args[2].c_str())) ? 0 : 1;
+}
+
+#else
+
+int Terrable::simulateDistributed(const Job&, TerrainSimulation&, std::string* error)
+{
+    *error = "--processes is only supported on Linux";
+    return -1;
+}
+
+int Terrable::runDistributedWorker(const std::vector<std::string>&)
+{
+    logMessage("--worker is only supported on Linux");
+    return 1;
+}
+
+#endif
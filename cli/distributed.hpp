@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "job.hpp"
+
+namespace Terrable
+{
+
+// runs job's years on steppedSimulation split into job.processes bands of rows, each simulated on one thread of its own
+// worker process. at job.syncsPerYear points per year, neighbouring workers swap the rows next to their shared border
+// and the runoff and gravity walks that crossed it. the terrain comes back into steppedSimulation; returns the whole
+// years simulated like simulateYears, or -1 on failure
+int simulateDistributed(const Job& job, TerrainSimulation& steppedSimulation, std::string* error);
+
+// main of a worker process started by simulateDistributed, which passes the file descriptors of its links in args
+int runDistributedWorker(const std::vector<std::string>& args);
+
+} // namespace Terrable
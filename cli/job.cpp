@@ -0,0 +1,689 @@
+#include "job.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+#include "distributed.hpp"
+#include "heightfield_io.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+using namespace Terrable;
+
+volatile std::sig_atomic_t Terrable::interruptRequested = 0;
+
+namespace
+{
+
+std::mutex logMutex;
+
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::string getStem(const std::string& path)
+{
+    const size_t slashPos = path.find_last_of("/\\");
+    std::string fileName = slashPos == std::string::npos ? path : path.substr(slashPos + 1);
+    const size_t dotPos = fileName.find_last_of('.');
+    return dotPos == std::string::npos ? fileName : fileName.substr(0, dotPos);
+}
+
+// the whitespace-separated args on each non-empty line of path that doesn't start with #, with the line numbers
+bool readArgLines(const std::string& path, std::vector<std::vector<std::string>>* lines, std::vector<int>* lineNumbers,
+    std::string* error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        *error = "could not open " + path;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+        std::istringstream stream(line);
+        std::vector<std::string> args;
+        std::string arg;
+        while (stream >> arg)
+        {
+            args.push_back(arg);
+        }
+
+        if (!args.empty() && args[0][0] != '#')
+        {
+            lines->push_back(args);
+            lineNumbers->push_back(lineNumber);
+        }
+    }
+    return true;
+}
+
+// variants are checked against the job they belong to once it is complete, but their options must parse
+bool readVariantFile(const std::string& path, std::vector<std::vector<std::string>>* variants, std::string* error)
+{
+    std::vector<int> lineNumbers;
+    variants->clear();
+    if (!readArgLines(path, variants, &lineNumbers, error))
+    {
+        return false;
+    }
+
+    for (size_t variantIdx = 0; variantIdx < variants->size(); ++variantIdx)
+    {
+        Job variant;
+        if (!parseJobArgs((*variants)[variantIdx], &variant, nullptr, error))
+        {
+            *error = path + ":" + std::to_string(lineNumbers[variantIdx]) + ": " + *error;
+            return false;
+        }
+    }
+    return true;
+}
+
+// variant args as a file name part, like seed3_lightning-chance0.01_execution-deferred
+std::string getVariantLabel(const std::vector<std::string>& args)
+{
+    std::string label;
+    for (size_t argIdx = 0; argIdx + 1 < args.size(); argIdx += 2)
+    {
+        const std::string& value = args[argIdx + 1];
+        std::string part = args[argIdx].substr(args[argIdx].find_first_not_of('-')) + (std::isalpha((unsigned char)value[0]) ? "-" : "") + value;
+        std::replace_if(part.begin(), part.end(), [](char c) { return !std::isalnum((unsigned char)c) && c != '.' && c != '-'; }, '-');
+        label += (label.empty() ? "" : "_") + part;
+    }
+    return label;
+}
+
+// the checks runJob makes before reading the input
+bool checkJob(const Job& job, std::string* error)
+{
+    if (!job.statsJson.empty() && !SimulationStats::enabled)
+    {
+        *error = "--stats-json needs a build with TERRABLE_ENABLE_STATS";
+        return false;
+    }
+
+    if (!job.statsJson.empty() && job.processes > 1)
+    {
+        *error = "--stats-json isn't supported with --processes";
+        return false;
+    }
+
+    for (const auto& outputName : getOutputNames(job))
+    {
+        if (getOutputPlaneCount(outputName) == 0)
+        {
+            *error = "unknown output " + outputName;
+            return false;
+        }
+    }
+    return true;
+}
+
+// enough digits that the value reads back exactly
+std::string formatFloat(float value)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    return buffer;
+}
+
+// simulates job on simulation, which holds its set-up input, and writes the outputs
+bool runSimulation(const Job& job, TerrainSimulation& simulation, ThreadPool& pool, std::string* error)
+{
+    simulation.setParams(job.params);
+    simulation.setSeed(job.seed);
+
+    // a preview runs the years on a downsampled proxy, whose changes are then upsampled onto the full-resolution layers
+    TerrainSimulation proxyInitial;
+    TerrainSimulation proxy;
+    if (job.previewScale > 1)
+    {
+        proxyInitial.downsampleFrom(simulation, job.previewScale, &pool);
+        proxy.downsampleFrom(simulation, job.previewScale, &pool);
+        proxy.setSeed(job.seed);
+    }
+    TerrainSimulation& steppedSimulation = job.previewScale > 1 ? proxy : simulation;
+
+    const int yearsSimulated = job.processes > 1 ? simulateDistributed(job, steppedSimulation, error)
+        : simulateYears(job, steppedSimulation, 0, pool);
+    if (yearsSimulated < 0)
+    {
+        return false;
+    }
+    if (yearsSimulated < job.years)
+    {
+        logMessage("%s: interrupted during year %d, writing partial result", job.input.c_str(), yearsSimulated);
+    }
+
+    if (job.previewScale > 1)
+    {
+        simulation.addUpsampledChange(proxyInitial, proxy, job.previewScale, &pool);
+    }
+
+    if (!job.statsJson.empty())
+    {
+        std::ofstream statsJsonFile(job.statsJson);
+        statsJsonFile << steppedSimulation.getStats().toJson() << "\n";
+        if (!statsJsonFile)
+        {
+            *error = "could not write " + job.statsJson;
+            return false;
+        }
+    }
+
+    const size_t numCells = (size_t)simulation.getWidth() * simulation.getHeight();
+    std::vector<float> outputValues;
+    for (const auto& outputName : getOutputNames(job))
+    {
+        outputValues.resize(numCells * getOutputPlaneCount(outputName));
+        extractOutput(simulation, outputName, outputValues.data(), pool);
+        if (!writeOutput(job, outputName, simulation.getWidth(), simulation.getHeight(), outputValues.data(), error))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+void Terrable::logMessage(const char* format, ...)
+{
+    std::lock_guard<std::mutex> lock(logMutex);
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stderr, format, args);
+    va_end(args);
+    std::fputc('\n', stderr);
+}
+
+bool Terrable::parseJobArgs(const std::vector<std::string>& args, Job* job, std::vector<std::string>* otherArgs, std::string* error)
+{
+    for (size_t argIdx = 0; argIdx < args.size(); ++argIdx)
+    {
+        const std::string& arg = args[argIdx];
+        if (argIdx + 1 >= args.size())
+        {
+            *error = "missing value for " + arg;
+            return false;
+        }
+
+        const std::string& value = args[++argIdx];
+        if (arg == "--input")
+        {
+            job->input = value;
+        }
+        else if (arg == "--raw-size")
+        {
+            if (std::sscanf(value.c_str(), "%dx%d", &job->rawWidth, &job->rawHeight) != 2)
+            {
+                *error = "invalid --raw-size " + value;
+                return false;
+            }
+        }
+        else if (arg == "--height-scale")
+        {
+            job->heightScale = std::strtof(value.c_str(), nullptr);
+        }
+        else if (arg == "--cell-size")
+        {
+            job->cellSize = std::strtof(value.c_str(), nullptr);
+        }
+        else if (arg == "--years")
+        {
+            job->years = std::atoi(value.c_str());
+        }
+        else if (arg == "--seed")
+        {
+            job->seed = std::atoi(value.c_str());
+        }
+        else if (arg == "--lightning-chance")
+        {
+            job->params.lightningChance = std::strtof(value.c_str(), nullptr);
+        }
+        else if (arg == "--boundary")
+        {
+            const auto modeIt = std::find(boundaryModeNames.begin(), boundaryModeNames.end(), value);
+            if (modeIt == boundaryModeNames.end())
+            {
+                *error = "invalid --boundary " + value;
+                return false;
+            }
+            job->params.boundaryMode = (BoundaryMode)(modeIt - boundaryModeNames.begin());
+        }
+        else if (arg == "--descent")
+        {
+            const auto modeIt = std::find(descentModeNames.begin(), descentModeNames.end(), value);
+            if (modeIt == descentModeNames.end())
+            {
+                *error = "invalid --descent " + value;
+                return false;
+            }
+            job->params.descentMode = (DescentMode)(modeIt - descentModeNames.begin());
+        }
+        else if (arg == "--event-order")
+        {
+            const auto orderIt = std::find(eventOrderNames.begin(), eventOrderNames.end(), value);
+            if (orderIt == eventOrderNames.end())
+            {
+                *error = "invalid --event-order " + value;
+                return false;
+            }
+            job->params.eventOrder = (EventOrder)(orderIt - eventOrderNames.begin());
+        }
+        else if (arg == "--execution")
+        {
+            const auto modeIt = std::find(executionModeNames.begin(), executionModeNames.end(), value);
+            if (modeIt == executionModeNames.end())
+            {
+                *error = "invalid --execution " + value;
+                return false;
+            }
+            job->params.executionMode = (ExecutionMode)(modeIt - executionModeNames.begin());
+        }
+        else if (arg == "--max-mass-drift")
+        {
+            job->params.maxMassDrift = std::strtof(value.c_str(), nullptr);
+        }
+        else if (arg == "--preview-scale")
+        {
+            job->previewScale = std::atoi(value.c_str());
+            if (job->previewScale < 1)
+            {
+                *error = "invalid --preview-scale " + value;
+                return false;
+            }
+        }
+        else if (arg == "--processes")
+        {
+            job->processes = std::atoi(value.c_str());
+            if (job->processes < 1)
+            {
+                *error = "invalid --processes " + value;
+                return false;
+            }
+        }
+        else if (arg == "--syncs-per-year")
+        {
+            job->syncsPerYear = std::atoi(value.c_str());
+            if (job->syncsPerYear < 1)
+            {
+                *error = "invalid --syncs-per-year " + value;
+                return false;
+            }
+        }
+        else if (arg == "--variants")
+        {
+            if (!readVariantFile(value, &job->variants, error))
+            {
+                return false;
+            }
+        }
+        else if (arg == "--seeds")
+        {
+            job->seeds.clear();
+            for (const auto& item : splitList(value))
+            {
+                // a range first-last, or a single seed
+                const size_t dashPos = item.find('-', 1);
+                const int first = std::atoi(item.substr(0, dashPos).c_str());
+                const int last = dashPos == std::string::npos ? first : std::atoi(item.substr(dashPos + 1).c_str());
+                if (last < first)
+                {
+                    *error = "invalid --seeds " + value;
+                    return false;
+                }
+                for (int seed = first; seed <= last; ++seed)
+                {
+                    job->seeds.push_back(seed);
+                }
+            }
+        }
+        else if (arg == "--output-dir")
+        {
+            job->outputDir = value;
+        }
+        else if (arg == "--name")
+        {
+            job->name = value;
+        }
+        else if (arg == "--format")
+        {
+            job->format = value;
+        }
+        else if (arg == "--outputs")
+        {
+            job->outputs = splitList(value);
+        }
+        else if (arg == "--stats-json")
+        {
+            job->statsJson = value;
+        }
+        else if (otherArgs)
+        {
+            otherArgs->push_back(arg);
+            otherArgs->push_back(value);
+        }
+        else
+        {
+            *error = "unknown argument " + arg;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Terrable::readJobFile(const std::string& path, const Job& defaults, std::vector<Job>* jobs, std::string* error)
+{
+    std::vector<std::vector<std::string>> lines;
+    std::vector<int> lineNumbers;
+    if (!readArgLines(path, &lines, &lineNumbers, error))
+    {
+        return false;
+    }
+
+    for (size_t lineIdx = 0; lineIdx < lines.size(); ++lineIdx)
+    {
+        Job job = defaults;
+        if (!parseJobArgs(lines[lineIdx], &job, nullptr, error))
+        {
+            *error = path + ":" + std::to_string(lineNumbers[lineIdx]) + ": " + *error;
+            return false;
+        }
+        jobs->push_back(job);
+    }
+    return true;
+}
+
+bool Terrable::getVariantJobs(const Job& job, std::vector<Job>* variantJobs, std::string* error)
+{
+    if (job.variants.empty() && job.seeds.empty())
+    {
+        variantJobs->push_back(job);
+        return true;
+    }
+
+    std::vector<std::vector<std::string>> variantArgs = job.variants;
+    if (variantArgs.empty())
+    {
+        variantArgs.emplace_back();
+    }
+    if (!job.seeds.empty())
+    {
+        std::vector<std::vector<std::string>> seededArgs;
+        for (const auto& args : variantArgs)
+        {
+            for (int seed : job.seeds)
+            {
+                seededArgs.push_back(args);
+                seededArgs.back().push_back("--seed");
+                seededArgs.back().push_back(std::to_string(seed));
+            }
+        }
+        variantArgs = seededArgs;
+    }
+
+    const std::string baseName = job.name.empty() ? getStem(job.input) : job.name;
+    std::set<std::string> names;
+    for (const auto& args : variantArgs)
+    {
+        Job variant = job;
+        variant.variants.clear();
+        variant.seeds.clear();
+        if (!parseJobArgs(args, &variant, nullptr, error))
+        {
+            return false;
+        }
+
+        // the shared layers are read and set up once, from the job's own options
+        if (variant.input != job.input || variant.rawWidth != job.rawWidth || variant.rawHeight != job.rawHeight
+            || variant.heightScale != job.heightScale || variant.cellSize != job.cellSize
+            || variant.params.boundaryMode != job.params.boundaryMode)
+        {
+            *error = "variants can't change --input, --raw-size, --height-scale, --cell-size or --boundary";
+            return false;
+        }
+        if (!variant.variants.empty() || !variant.seeds.empty())
+        {
+            *error = "variants can't have --variants or --seeds of their own";
+            return false;
+        }
+
+        // a variant that names itself keeps its name, apart from the seed it is run with
+        const std::string label = getVariantLabel(args);
+        if (variant.name == job.name)
+        {
+            variant.name = baseName + "_" + label;
+        }
+        else if (!job.seeds.empty())
+        {
+            variant.name += "_" + getVariantLabel(std::vector<std::string>(args.end() - 2, args.end()));
+        }
+        if (!variant.statsJson.empty() && variant.statsJson == job.statsJson)
+        {
+            const size_t dotPos = job.statsJson.find_last_of('.');
+            const size_t slashPos = job.statsJson.find_last_of("/\\");
+            const size_t labelPos = dotPos == std::string::npos || (slashPos != std::string::npos && dotPos < slashPos)
+                ? job.statsJson.size() : dotPos;
+            variant.statsJson.insert(labelPos, "_" + label);
+        }
+        if (!names.insert(variant.outputDir + "/" + variant.name).second)
+        {
+            *error = "more than one variant writes " + variant.name;
+            return false;
+        }
+        variantJobs->push_back(variant);
+    }
+    return true;
+}
+
+std::vector<std::string> Terrable::getSimulationArgs(const Job& job)
+{
+    const SimulationParams& params = job.params;
+    return {
+        "--cell-size", formatFloat(job.cellSize),
+        "--years", std::to_string(job.years),
+        "--seed", std::to_string(job.seed),
+        "--lightning-chance", formatFloat(params.lightningChance),
+        "--boundary", boundaryModeNames[(int)params.boundaryMode],
+        "--descent", descentModeNames[(int)params.descentMode],
+        "--event-order", eventOrderNames[(int)params.eventOrder],
+        "--execution", executionModeNames[(int)params.executionMode],
+        "--max-mass-drift", formatFloat(params.maxMassDrift),
+        "--preview-scale", std::to_string(job.previewScale)
+    };
+}
+
+std::vector<std::string> Terrable::getOutputNames(const Job& job)
+{
+    std::vector<std::string> outputs = job.outputs;
+    if (outputs.empty())
+    {
+        outputs.assign(terrainLayerNames.begin(), terrainLayerNames.end());
+        outputs.push_back("height");
+        outputs.push_back("color");
+    }
+    return outputs;
+}
+
+int Terrable::getOutputPlaneCount(const std::string& outputName)
+{
+    if (outputName == "color")
+    {
+        return 3;
+    }
+    const bool isLayer = std::find(terrainLayerNames.begin(), terrainLayerNames.end(), outputName) != terrainLayerNames.end();
+    return isLayer || outputName == "height" ? 1 : 0;
+}
+
+void Terrable::extractOutput(const TerrainSimulation& simulation, const std::string& outputName, float* out, ThreadPool& pool)
+{
+    const size_t numCells = (size_t)simulation.getWidth() * simulation.getHeight();
+    const auto layerIt = std::find(terrainLayerNames.begin(), terrainLayerNames.end(), outputName);
+    if (layerIt != terrainLayerNames.end())
+    {
+        // layer planes have a ghost border and may be tiled, so copy out just the cells row by row
+        const TerrainLayer layer = (TerrainLayer)(layerIt - terrainLayerNames.begin());
+        for (int y = 0; y < simulation.getHeight(); ++y)
+        {
+            simulation.readLayerRow(layer, 0, y, simulation.getWidth(), &out[(size_t)y * simulation.getWidth()]);
+        }
+    }
+    else if (outputName == "height")
+    {
+        simulation.writeSurface(pool, out, { nullptr, nullptr, nullptr });
+    }
+    else if (outputName == "color")
+    {
+        simulation.writeSurface(pool, nullptr, { &out[0], &out[numCells], &out[2 * numCells] });
+    }
+}
+
+void Terrable::setUpSimulation(const Job& job, int width, int height, const float* heights, ThreadPool& pool,
+    TerrainSimulation* simulation)
+{
+    // bedrock is written from the heights, so only the layers above it are cleared
+    simulation->setTerrainSize(width, height, job.cellSize, &pool, MemoryPlacement::SPREAD, false);
+    simulation->setParams(job.params);
+    simulation->setSeed(job.seed);
+
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+    {
+        if ((TerrainLayer)terrainLayerIdx != TerrainLayer::BEDROCK)
+        {
+            simulation->clearLayer((TerrainLayer)terrainLayerIdx, &pool);
+        }
+    }
+    for (int y = 0; y < height; ++y)
+    {
+        simulation->writeLayerRow(TerrainLayer::BEDROCK, 0, y, width, &heights[(size_t)y * width]);
+    }
+    simulation->initializeHumusFromBedrock(pool);
+}
+
+int Terrable::simulateYears(const Job& job, TerrainSimulation& steppedSimulation, int firstYear, ThreadPool& pool,
+    const std::function<bool()>& shouldContinue)
+{
+    for (int step = firstYear; step < job.years; ++step)
+    {
+        TERRABLE_TRACE_SCOPE("year", "year", step);
+        if (!steppedSimulation.stepSimulation([&](float) { return interruptRequested == 0 && (!shouldContinue || shouldContinue()); }, &pool))
+        {
+            return step;
+        }
+        if (steppedSimulation.getLastMassDrift() > job.params.maxMassDrift)
+        {
+            logMessage("%s: mass drifted by %g in year %d, finished the year serially", job.input.c_str(),
+                steppedSimulation.getLastMassDrift(), step);
+        }
+    }
+    return std::max(job.years, firstYear);
+}
+
+bool Terrable::runJob(const Job& job, ThreadPool& pool, std::string* error)
+{
+    if (job.input.empty())
+    {
+        *error = "no input given";
+        return false;
+    }
+
+    std::vector<Job> variantJobs;
+    if (!getVariantJobs(job, &variantJobs, error))
+    {
+        return false;
+    }
+    for (const auto& variantJob : variantJobs)
+    {
+        if (!checkJob(variantJob, error))
+        {
+            return false;
+        }
+    }
+
+    TERRABLE_TRACE_SCOPE("job");
+
+    Heightfield input;
+    if (!readHeightfield(job.input, &input, error, job.rawWidth, job.rawHeight))
+    {
+        return false;
+    }
+
+    std::transform(input.values.begin(), input.values.end(), input.values.begin(), [&](float value) { return value * job.heightScale; });
+    TerrainSimulation simulation;
+    setUpSimulation(job, input.width, input.height, input.values.data(), pool, &simulation);
+    if (variantJobs.size() == 1)
+    {
+        return runSimulation(variantJobs[0], simulation, pool, error);
+    }
+
+    // one task per variant, each simulating a copy of the set-up input, which is only read from then on
+    std::mutex errorMutex;
+    bool succeeded = true;
+    pool.parallelFor(0, (int)variantJobs.size(), 1, [&](int variantBegin, int variantEnd)
+    {
+        for (int variantIdx = variantBegin; variantIdx < variantEnd; ++variantIdx)
+        {
+            TERRABLE_TRACE_SCOPE("variant", "variant", variantIdx);
+            const Job& variantJob = variantJobs[variantIdx];
+            TerrainSimulation variantSimulation(simulation);
+            std::string variantError;
+            if (runSimulation(variantJob, variantSimulation, pool, &variantError))
+            {
+                logMessage("%s: variant %s done", job.input.c_str(), variantJob.name.c_str());
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(errorMutex);
+            *error = succeeded ? variantJob.name + ": " + variantError : *error;
+            succeeded = false;
+        }
+    });
+    return succeeded;
+}
+
+bool Terrable::writeOutput(const Job& job, const std::string& outputName, int width, int height, const float* values,
+    std::string* error)
+{
+    const std::string prefix = job.outputDir + "/" + (job.name.empty() ? getStem(job.input) : job.name) + "_";
+    const std::string extension = "." + job.format;
+    if (outputName != "color")
+    {
+        return writeHeightfield(prefix + outputName + extension, width, height, values, error);
+    }
+
+    const size_t numCells = (size_t)width * height;
+    const char* suffixes[] = { "x", "y", "z" };
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!writeHeightfield(prefix + "color." + suffixes[i] + extension, width, height, &values[i * numCells], error))
+        {
+            return false;
+        }
+    }
+    return true;
+}
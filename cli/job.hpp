@@ -0,0 +1,86 @@
+#pragma once
+
+#include <csignal>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "terrain_simulation.hpp"
+
+namespace Terrable
+{
+
+class ThreadPool;
+
+struct Job
+{
+    std::string input;
+    int rawWidth = 0;
+    int rawHeight = 0;
+    float heightScale = 1.f;
+    float cellSize = 1.f;
+    int years = 1;
+    int seed = 0;
+    SimulationParams params;
+    int previewScale = 1;
+    int processes = 1;
+    int syncsPerYear = 64;
+    std::string outputDir = ".";
+    std::string name;
+    std::string format = "exr";
+    std::vector<std::string> outputs;
+    std::string statsJson;
+    // job options of each variant, applied on top of the others; every variant is run for every one of seeds
+    std::vector<std::vector<std::string>> variants;
+    std::vector<int> seeds;
+};
+
+// set on Ctrl-C; running jobs stop within a few thousand events
+extern volatile std::sig_atomic_t interruptRequested;
+
+// printf to stderr, one line at a time across threads
+void logMessage(const char* format, ...);
+
+// applies job options from args, leaving anything not mentioned unchanged; non-job options are returned in otherArgs
+bool parseJobArgs(const std::vector<std::string>& args, Job* job, std::vector<std::string>* otherArgs, std::string* error);
+
+// each non-empty line that doesn't start with # holds job options, which override those in defaults
+bool readJobFile(const std::string& path, const Job& defaults, std::vector<Job>* jobs, std::string* error);
+
+// the jobs that job's variants and seeds expand into, each named after the options it sets, or job alone if it has
+// neither. variants can't change the input or anything its layers are set up with
+bool getVariantJobs(const Job& job, std::vector<Job>* variantJobs, std::string* error);
+
+// job options that reproduce job's simulation from its already scaled input heights: everything but the input and
+// output options and --height-scale
+std::vector<std::string> getSimulationArgs(const Job& job);
+
+// the outputs job writes, all layers plus height and color if it doesn't list any
+std::vector<std::string> getOutputNames(const Job& job);
+
+// planes an output fills: 3 for color, 1 for height and the layers, 0 for unknown names
+int getOutputPlaneCount(const std::string& outputName);
+
+// fills the getOutputPlaneCount(outputName) planes of width * height values at out, one after the other
+void extractOutput(const TerrainSimulation& simulation, const std::string& outputName, float* out, ThreadPool& pool);
+
+// same setup as the SOP's height-only input: bedrock = heights (already scaled), humus from bedrock slope, everything
+// else 0
+void setUpSimulation(const Job& job, int width, int height, const float* heights, ThreadPool& pool,
+    TerrainSimulation* simulation);
+
+// runs years firstYear onwards of job on steppedSimulation (a preview proxy or the terrain itself), logging drift
+// fallbacks. returns the whole years simulated by the end, which is less than job.years if interrupted or
+// shouldContinue returned false; the terrain is then left where it stopped
+int simulateYears(const Job& job, TerrainSimulation& steppedSimulation, int firstYear, ThreadPool& pool,
+    const std::function<bool()>& shouldContinue = nullptr);
+
+// writes one output's planes, as filled by extractOutput, to job's output files
+bool writeOutput(const Job& job, const std::string& outputName, int width, int height, const float* values,
+    std::string* error);
+
+// reads the input, simulates and writes the outputs, all in this process. the input is set up once for all of job's
+// variants, which are then simulated concurrently on pool from copies of it
+bool runJob(const Job& job, ThreadPool& pool, std::string* error);
+
+} // namespace Terrable
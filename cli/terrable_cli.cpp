@@ -0,0 +1,211 @@
+// headless batch driver for the Terrable simulation core.
+// runs one job from the command line, or many jobs from a job file concurrently in one process over a shared thread pool.
+//
+// usage: terrable_cli [job options] [--jobs jobs.txt] [--threads N] [--pin-threads 0|1] [--trace trace.json]
+//                     [--daemon socket]
+//        terrable_cli --serve socket [--cache-mb N] [--threads N] [--pin-threads 0|1] [--trace trace.json]
+//
+// --serve runs a long-lived daemon on a Unix socket, which runs the jobs of --daemon clients on one thread pool. the
+// input heights and the outputs go through POSIX shared memory, and prepared inputs and finished runs stay cached (up
+// to --cache-mb of layers, default 1024), so a job that repeats or extends an earlier one resumes from its result.
+// --daemon runs the jobs on such a daemon instead of in this process; --stats-json isn't supported there
+//
+// --processes starts local worker processes that each simulate a band of rows on one thread, swapping the rows along
+// their borders and the runoff and gravity walks that cross them over Unix sockets (Linux only). it isn't supported
+// with --daemon or --stats-json
+//
+// --pin-threads 1 keeps the pool's worker threads on the cores of NUMA nodes spread evenly over the nodes
+//
+// --trace (or the TERRABLE_TRACE environment variable) writes a Chrome trace of the whole run;
+// TERRABLE_TRACE_DETAIL=events adds one zone per simulated event
+//
+// job options:
+//   --input path              heightfield used as bedrock (.raw, .pgm, .exr)
+//   --raw-size WxH            dimensions of a .raw input (square inputs are inferred from the file size)
+//   --height-scale f          multiplier applied to input heights (default 1)
+//   --cell-size f             world size of one cell (default 1)
+//   --years N                 simulated years (default 1)
+//   --seed N                  random seed (default 0)
+//   --lightning-chance f      maximum lightning probability per cell (default 0.005)
+//   --boundary clamp|wrap|open  what lies beyond the terrain edge (default clamp)
+//   --descent d4|d8           neighbours runoff and gravity can move to (default d4)
+//   --event-order random|batched  run events as drawn, or grouped by type and tile (default random)
+//   --execution serial|hogwild|deferred  run events one by one, on all threads at once nondeterministically, or on all
+//                             threads in batches merged in a fixed order (default serial)
+//   --max-mass-drift f        hogwild only: relative mass drift that falls back to serial for the year (default 0.001)
+//   --preview-scale N         simulate at 1/N resolution and upsample the layer changes onto the input (default 1)
+//   --processes N             split the terrain into N bands of rows simulated by worker processes (default 1)
+//   --syncs-per-year N        with --processes: times per year neighbouring bands swap border rows and walks (default 64)
+//   --variants path           run one variant per non-empty line not starting with #, which holds job options applied
+//                             on top of the others (not --input, --raw-size, --height-scale, --cell-size or --boundary)
+//   --seeds list              run every variant with each of these comma-separated seeds or ranges like 0-15
+//   --output-dir dir          directory for outputs (default .)
+//   --name name               output file prefix (default input file name without extension)
+//   --format exr|pgm|raw      output format (default exr)
+//   --outputs list            comma-separated subset of layer names, height, color (default all)
+//   --stats-json path         per-event-type stats summary (needs a build with TERRABLE_ENABLE_STATS)
+//
+// a job with --variants or --seeds reads and sets up its input once, then simulates its variants concurrently on the
+// thread pool, each from its own copy of the set-up layers. every variant's outputs are named after the job, then the
+// options the variant sets, like terrain_seed3_lightning-chance0.01_height.exr, unless the variant sets --name
+//
+// on Ctrl-C, running jobs stop within a few thousand events and still write the terrain reached so far.
+//
+// each non-empty line of a job file that doesn't start with # holds job options, which override those on the command line.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "daemon.hpp"
+#include "distributed.hpp"
+#include "job.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+using namespace Terrable;
+
+namespace
+{
+
+void handleInterrupt(int)
+{
+    interruptRequested = 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2 && std::string(argv[1]) == "--worker")
+    {
+        std::signal(SIGINT, handleInterrupt);
+        std::signal(SIGTERM, handleInterrupt);
+        return runDistributedWorker(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    Job defaults;
+    std::vector<std::string> otherArgs;
+    std::string error;
+    if (!parseJobArgs(std::vector<std::string>(argv + 1, argv + argc), &defaults, &otherArgs, &error))
+    {
+        logMessage("%s", error.c_str());
+        return 1;
+    }
+
+    std::string jobFile;
+    std::string serveSocket;
+    std::string daemonSocket;
+    size_t cacheBytes = (size_t)1024 << 20;
+    std::string tracePath = Tracer::getEnvPath() ? Tracer::getEnvPath() : "";
+    int numThreads = 0;
+    bool pinThreads = false;
+    for (size_t argIdx = 0; argIdx < otherArgs.size(); argIdx += 2)
+    {
+        if (otherArgs[argIdx] == "--jobs")
+        {
+            jobFile = otherArgs[argIdx + 1];
+        }
+        else if (otherArgs[argIdx] == "--threads")
+        {
+            numThreads = std::atoi(otherArgs[argIdx + 1].c_str());
+        }
+        else if (otherArgs[argIdx] == "--pin-threads")
+        {
+            pinThreads = otherArgs[argIdx + 1] == "1";
+        }
+        else if (otherArgs[argIdx] == "--serve")
+        {
+            serveSocket = otherArgs[argIdx + 1];
+        }
+        else if (otherArgs[argIdx] == "--daemon")
+        {
+            daemonSocket = otherArgs[argIdx + 1];
+        }
+        else if (otherArgs[argIdx] == "--cache-mb")
+        {
+            cacheBytes = (size_t)std::atoll(otherArgs[argIdx + 1].c_str()) << 20;
+        }
+        else if (otherArgs[argIdx] == "--trace")
+        {
+            tracePath = otherArgs[argIdx + 1];
+        }
+        else
+        {
+            logMessage("unknown argument %s", otherArgs[argIdx].c_str());
+            return 1;
+        }
+    }
+
+    if (!serveSocket.empty())
+    {
+        std::signal(SIGINT, handleInterrupt);
+        std::signal(SIGTERM, handleInterrupt);
+        if (!tracePath.empty())
+        {
+            Tracer::start(tracePath, Tracer::getEnvDetail());
+        }
+
+        ThreadPool pool(numThreads, pinThreads);
+        const bool served = serveDaemon(serveSocket, cacheBytes, pool, &error);
+        if (!served || (!tracePath.empty() && !Tracer::stop(&error)))
+        {
+            logMessage("%s", error.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    std::vector<Job> jobs;
+    if (jobFile.empty())
+    {
+        jobs.push_back(defaults);
+    }
+    else if (!readJobFile(jobFile, defaults, &jobs, &error))
+    {
+        logMessage("%s", error.c_str());
+        return 1;
+    }
+
+    std::signal(SIGINT, handleInterrupt);
+
+    if (!tracePath.empty())
+    {
+        Tracer::start(tracePath, Tracer::getEnvDetail());
+    }
+
+    // one task per job; the calling thread takes jobs too, and each job's grid passes share the same pool
+    ThreadPool pool(numThreads, pinThreads);
+    std::atomic<int> numFailed(0);
+    pool.parallelFor(0, (int)jobs.size(), 1, [&](int jobBegin, int jobEnd)
+    {
+        for (int jobIdx = jobBegin; jobIdx < jobEnd; ++jobIdx)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            std::string jobError;
+            const bool succeeded = daemonSocket.empty() ? runJob(jobs[jobIdx], pool, &jobError)
+                                                         : runDaemonJob(jobs[jobIdx], daemonSocket, &jobError);
+            if (succeeded)
+            {
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                logMessage("job %d (%s): done in %.2f s", jobIdx, jobs[jobIdx].input.c_str(), seconds);
+            }
+            else
+            {
+                logMessage("job %d (%s): %s", jobIdx, jobs[jobIdx].input.c_str(), jobError.c_str());
+                ++numFailed;
+            }
+        }
+    });
+
+    if (!tracePath.empty() && !Tracer::stop(&error))
+    {
+        logMessage("%s", error.c_str());
+        return 1;
+    }
+
+    return numFailed > 0 ? 1 : 0;
+}
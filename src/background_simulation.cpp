@@ -0,0 +1,154 @@
+#include "background_simulation.hpp"
+
+#include <atomic>
+#include <chrono>
+
+#include "trace.hpp"
+
+using namespace Terrable;
+
+BackgroundSimulation::BackgroundSimulation()
+    : thread(&BackgroundSimulation::run, this)
+{
+}
+
+BackgroundSimulation::~BackgroundSimulation()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        pendingSimulation.reset();
+        activeJobId = 0;
+    }
+    jobAvailable.notify_one();
+    thread.join();
+}
+
+int BackgroundSimulation::start(std::unique_ptr<TerrainSimulation> simulation, int years)
+{
+    int jobId;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobId = status.jobId + 1;
+        status = Status();
+        status.jobId = jobId;
+        status.years = years;
+        status.running = true;
+        pendingSimulation = std::move(simulation);
+        activeJobId = jobId;
+    }
+    jobAvailable.notify_one();
+    return jobId;
+}
+
+void BackgroundSimulation::cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const int jobId = status.jobId + 1;
+    status = Status();
+    status.jobId = jobId;
+    pendingSimulation.reset();
+    activeJobId = 0;
+}
+
+BackgroundSimulation::Status BackgroundSimulation::getStatus() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return status;
+}
+
+void BackgroundSimulation::run()
+{
+    while (true)
+    {
+        std::unique_ptr<TerrainSimulation> simulation;
+        int jobId;
+        int years;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [&]() { return stopping || pendingSimulation; });
+            if (stopping)
+            {
+                return;
+            }
+
+            simulation = std::move(pendingSimulation);
+            jobId = status.jobId;
+            years = status.years;
+        }
+
+        // snapshots are copied here between events, so each one is a consistent state. only the layer planes and stats
+        // are copied, into the spare buffer unless a cook still holds it from an earlier publish. a job that has been
+        // replaced in the meantime publishes nothing
+        auto publish = [&](float yearsSimulated, bool finished)
+        {
+            std::shared_ptr<TerrainSimulation> snapshot;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                snapshot = std::move(spareSnapshot);
+            }
+            if (!snapshot || snapshot.use_count() > 1)
+            {
+                snapshot = std::make_shared<TerrainSimulation>();
+            }
+            // pairs with the release of the last cook dropping its reference, whose reads then come before the copy
+            std::atomic_thread_fence(std::memory_order_acquire);
+            snapshot->copyLayersFrom(*simulation);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (status.jobId != jobId)
+            {
+                spareSnapshot = std::move(snapshot);
+                return;
+            }
+            spareSnapshot = std::const_pointer_cast<TerrainSimulation>(std::move(status.snapshot));
+            status.snapshot = std::move(snapshot);
+            status.snapshotYears = yearsSimulated;
+            status.snapshotCount = ++snapshotCount;
+            status.yearsSimulated = yearsSimulated;
+            status.running = !finished;
+        };
+
+        if (years == 0)
+        {
+            publish(0.f, true);
+        }
+
+        auto lastPublish = std::chrono::steady_clock::now();
+        bool cancelled = false;
+        for (int year = 0; year < years && !cancelled; ++year)
+        {
+            TERRABLE_TRACE_SCOPE("background year", "year", year);
+            cancelled = !simulation->stepSimulation([&](float yearProgress)
+            {
+                if (activeJobId != jobId)
+                {
+                    return false;
+                }
+
+                const float yearsSimulated = year + yearProgress;
+                const auto now = std::chrono::steady_clock::now();
+                if (std::chrono::duration<double>(now - lastPublish).count() >= snapshotIntervalSeconds)
+                {
+                    publish(yearsSimulated, false);
+                    lastPublish = now;
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (status.jobId == jobId)
+                    {
+                        status.yearsSimulated = yearsSimulated;
+                    }
+                }
+                return true;
+            });
+
+            if (!cancelled)
+            {
+                publish((float)(year + 1), year + 1 == years);
+                lastPublish = std::chrono::steady_clock::now();
+            }
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "terrain_simulation.hpp"
+
+namespace Terrable
+{
+
+// runs one simulation at a time on a thread it owns, so whoever starts it can return straight away and pick up the
+// latest state later. starting another job cancels the running one within a few thousand events. parallel execution
+// modes use the shared pool
+class BackgroundSimulation
+{
+public:
+    struct Status
+    {
+        // the job started last, 0 before the first; its years and how far it has got
+        int jobId = 0;
+        int years = 0;
+        float yearsSimulated = 0.f;
+        bool running = false;
+
+        // the layers and stats of the latest published state of that job, how many years it holds, and the number of
+        // snapshots published before it; null until the first one is published
+        std::shared_ptr<const TerrainSimulation> snapshot;
+        float snapshotYears = 0.f;
+        int snapshotCount = 0;
+    };
+
+    // snapshots are published after every year, and within a year at most this often
+    static constexpr double snapshotIntervalSeconds = 1.0;
+
+    BackgroundSimulation();
+
+    // cancels the running job and joins the thread, which takes until the job's next progress check
+    ~BackgroundSimulation();
+
+    BackgroundSimulation(const BackgroundSimulation&) = delete;
+    BackgroundSimulation& operator=(const BackgroundSimulation&) = delete;
+
+    // cancels the running job and starts simulating years years of simulation, which must be set up, filled and
+    // seeded; returns the new job's id
+    int start(std::unique_ptr<TerrainSimulation> simulation, int years);
+    // cancels the running job. its id is retired, so even a job already past its last progress check publishes nothing
+    // more; the status then has the next id, no snapshot and nothing running
+    void cancel();
+
+    Status getStatus() const;
+
+    // snapshots published so far by any job; cheap enough to poll, unlike getStatus
+    int getSnapshotCount() const { return snapshotCount; }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable jobAvailable;
+
+    // the job waiting to be picked up, if any, described by status
+    std::unique_ptr<TerrainSimulation> pendingSimulation;
+    bool stopping = false;
+    Status status;
+
+    // the only job that may keep running; anything else makes the running job stop at its next progress check
+    std::atomic<int> activeJobId{ 0 };
+    std::atomic<int> snapshotCount{ 0 };
+
+    // snapshots alternate between two buffers; the one not published is refilled once nothing holds it any more
+    std::shared_ptr<TerrainSimulation> spareSnapshot;
+
+    std::thread thread;
+
+    void run();
+};
+
+} // namespace Terrable
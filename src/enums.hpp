@@ -3,6 +3,8 @@
 #include <string>
 #include <array>
 
+#include "vec2i.hpp"
+
 namespace Terrable
 {
     enum class TerrainLayer
@@ -27,14 +29,16 @@ namespace Terrable
         "dead_vegetation"
     };
 
-    static std::array<UT_Vector3, numTerrainLayers> terrainLayerColors = {
-        UT_Vector3(0.2f, 0.2f, 0.2f), // bedrock
-        UT_Vector3(0.4f, 0.4f, 0.4f), // rock
-        UT_Vector3(255, 230, 128) / 255.f, // sand
-        UT_Vector3(135, 97, 32) / 255.f, // humus
-        UT_Vector3(1.f, 0.f, 1.f), // moisture
-        UT_Vector3(1.f, 0.f, 1.f), // vegetation
-        UT_Vector3(1.f, 0.f, 1.f), // dead_vegetation
+    using LayerColor = std::array<float, 3>;
+
+    static std::array<LayerColor, numTerrainLayers> terrainLayerColors = {
+        LayerColor{ 0.2f, 0.2f, 0.2f }, // bedrock
+        LayerColor{ 0.4f, 0.4f, 0.4f }, // rock
+        LayerColor{ 255 / 255.f, 230 / 255.f, 128 / 255.f }, // sand
+        LayerColor{ 135 / 255.f, 97 / 255.f, 32 / 255.f }, // humus
+        LayerColor{ 1.f, 0.f, 1.f }, // moisture
+        LayerColor{ 1.f, 0.f, 1.f }, // vegetation
+        LayerColor{ 1.f, 0.f, 1.f }, // dead_vegetation
     };
 
     enum class Event
@@ -47,10 +51,97 @@ namespace Terrable
     };
     static constexpr int numEvents = (int)Event::FIRE + 1;
 
-    static std::array<UT_Vector2i, 4> cardinalDirections = {
-        UT_Vector2i(1, 0),
-        UT_Vector2i(0, 1),
-        UT_Vector2i(-1, 0),
-        UT_Vector2i(0, -1)
+    // what lies beyond the grid edge: a copy of the edge (no flow across it), the opposite edge (tileable terrain),
+    // or terrain continuing the edge slope that walkers leave the grid through, taking what they carry with them
+    enum class BoundaryMode
+    {
+        CLAMP,
+        WRAP,
+        OPEN
+    };
+    static constexpr int numBoundaryModes = (int)BoundaryMode::OPEN + 1;
+
+    static std::array<std::string, numBoundaryModes> boundaryModeNames = {
+        "clamp",
+        "wrap",
+        "open"
+    };
+
+    // which neighbours runoff and gravity walks can descend to: the 4 cardinal ones, or all 8
+    enum class DescentMode
+    {
+        D4,
+        D8
+    };
+    static constexpr int numDescentModes = (int)DescentMode::D8 + 1;
+
+    static std::array<std::string, numDescentModes> descentModeNames = {
+        "d4",
+        "d8"
+    };
+
+    // order events run in within a year: as drawn, or drawn in batches that are grouped by event type and then by tile
+    enum class EventOrder
+    {
+        RANDOM,
+        BATCHED
+    };
+    static constexpr int numEventOrders = (int)EventOrder::BATCHED + 1;
+
+    static std::array<std::string, numEventOrders> eventOrderNames = {
+        "random",
+        "batched"
+    };
+
+    // how a year's events are executed: one after another on the calling thread, by all threads of a pool at once with
+    // atomic layer updates and no coordination (hogwild), which is faster but not reproducible, or by all threads in
+    // batches that read the terrain as it was at the start of the batch and merge their changes in a fixed order
+    // afterwards (deferred), which is reproducible for a given seed and thread count
+    enum class ExecutionMode
+    {
+        SERIAL,
+        HOGWILD,
+        DEFERRED
+    };
+    static constexpr int numExecutionModes = (int)ExecutionMode::DEFERRED + 1;
+
+    static std::array<std::string, numExecutionModes> executionModeNames = {
+        "serial",
+        "hogwild",
+        "deferred"
+    };
+
+    // where the pages of the layer planes live: wherever the thread that sizes the terrain runs (local), or in row bands
+    // bound to each NUMA node in turn and filled in parallel (spread)
+    enum class MemoryPlacement
+    {
+        LOCAL,
+        SPREAD
+    };
+    static constexpr int numMemoryPlacements = (int)MemoryPlacement::SPREAD + 1;
+
+    static std::array<std::string, numMemoryPlacements> memoryPlacementNames = {
+        "local",
+        "spread"
+    };
+
+    static std::array<Vec2i, 4> cardinalDirections = {
+        Vec2i(1, 0),
+        Vec2i(0, 1),
+        Vec2i(-1, 0),
+        Vec2i(0, -1)
+    };
+
+    // cardinal directions first, so the first 4 entries match cardinalDirections; constexpr so per-direction index
+    // arithmetic folds away once walks are unrolled
+    static constexpr std::array<Vec2i, 8> neighbourDirections = {
+        Vec2i(1, 0),
+        Vec2i(0, 1),
+        Vec2i(-1, 0),
+        Vec2i(0, -1),
+        Vec2i(1, 1),
+        Vec2i(-1, 1),
+        Vec2i(-1, -1),
+        Vec2i(1, -1)
     };
 }
@@ -0,0 +1,572 @@
+#include "heightfield_io.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+using namespace Terrable;
+
+namespace
+{
+
+std::string getExtension(const std::string& path)
+{
+    const size_t dotPos = path.find_last_of('.');
+    if (dotPos == std::string::npos)
+    {
+        return "";
+    }
+
+    std::string extension = path.substr(dotPos + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return extension;
+}
+
+bool readFile(const std::string& path, std::vector<char>* data, std::string* error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        *error = "could not open " + path;
+        return false;
+    }
+
+    data->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool writeFile(const std::string& path, const std::vector<char>& data, std::string* error)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file || !file.write(data.data(), data.size()))
+    {
+        *error = "could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+// little-endian readers/writers; all supported hosts are little-endian, matching raw and exr byte order
+
+template <typename T>
+T readLE(const char* data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+template <typename T>
+void appendLE(std::vector<char>* data, T value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    data->insert(data->end(), bytes, bytes + sizeof(T));
+}
+
+void appendString(std::vector<char>* data, const char* str)
+{
+    data->insert(data->end(), str, str + std::strlen(str) + 1);
+}
+
+float halfToFloat(uint16_t half)
+{
+    const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+
+    uint32_t bits;
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // denormal: renormalize
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+        }
+    }
+    else if (exponent == 0x1F)
+    {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+// raw
+
+bool readRaw(const std::vector<char>& data, Heightfield* heightfield, std::string* error, int rawWidth, int rawHeight)
+{
+    const size_t numValues = data.size() / sizeof(float);
+    if (rawWidth <= 0 || rawHeight <= 0)
+    {
+        const int side = (int)(std::sqrt((double)numValues) + 0.5);
+        if ((size_t)side * side != numValues)
+        {
+            *error = "raw file is not square; dimensions must be given explicitly";
+            return false;
+        }
+        rawWidth = side;
+        rawHeight = side;
+    }
+
+    if ((size_t)rawWidth * rawHeight != numValues)
+    {
+        *error = "raw file size does not match the given dimensions";
+        return false;
+    }
+
+    heightfield->width = rawWidth;
+    heightfield->height = rawHeight;
+    heightfield->values.resize(numValues);
+    std::memcpy(heightfield->values.data(), data.data(), numValues * sizeof(float));
+    return true;
+}
+
+bool writeRaw(const std::string& path, int width, int height, const float* values, std::string* error)
+{
+    std::vector<char> data(reinterpret_cast<const char*>(values), reinterpret_cast<const char*>(values + (size_t)width * height));
+    return writeFile(path, data, error);
+}
+
+// pgm
+
+constexpr const char* pgmRangeComment = "terrable range";
+
+bool readPgm(const std::vector<char>& data, Heightfield* heightfield, std::string* error)
+{
+    size_t pos = 0;
+    float rangeMin = 0.f;
+    float rangeMax = 1.f;
+
+    // reads the next header token, skipping whitespace and comments (and picking up our range comment)
+    auto nextToken = [&]() -> std::string
+    {
+        while (pos < data.size())
+        {
+            if (std::isspace((unsigned char)data[pos]))
+            {
+                ++pos;
+            }
+            else if (data[pos] == '#')
+            {
+                const size_t lineEnd = std::find(data.begin() + pos, data.end(), '\n') - data.begin();
+                const std::string comment(data.begin() + pos + 1, data.begin() + lineEnd);
+                const size_t rangePos = comment.find(pgmRangeComment);
+                if (rangePos != std::string::npos)
+                {
+                    std::istringstream(comment.substr(rangePos + std::strlen(pgmRangeComment))) >> rangeMin >> rangeMax;
+                }
+                pos = lineEnd;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        const size_t start = pos;
+        while (pos < data.size() && !std::isspace((unsigned char)data[pos]))
+        {
+            ++pos;
+        }
+        return std::string(data.begin() + start, data.begin() + pos);
+    };
+
+    const std::string magic = nextToken();
+    if (magic != "P5" && magic != "P2")
+    {
+        *error = "unsupported pgm type " + magic;
+        return false;
+    }
+
+    const int width = std::atoi(nextToken().c_str());
+    const int height = std::atoi(nextToken().c_str());
+    const int maxValue = std::atoi(nextToken().c_str());
+    if (width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 65535)
+    {
+        *error = "invalid pgm header";
+        return false;
+    }
+
+    const size_t numValues = (size_t)width * height;
+    heightfield->width = width;
+    heightfield->height = height;
+    heightfield->values.resize(numValues);
+
+    const float scale = (rangeMax - rangeMin) / maxValue;
+
+    if (magic == "P2")
+    {
+        for (size_t valueIdx = 0; valueIdx < numValues; ++valueIdx)
+        {
+            const std::string token = nextToken();
+            if (token.empty())
+            {
+                *error = "pgm data is truncated";
+                return false;
+            }
+            heightfield->values[valueIdx] = rangeMin + std::atoi(token.c_str()) * scale;
+        }
+        return true;
+    }
+
+    ++pos; // single whitespace after maxval
+    const int bytesPerValue = maxValue < 256 ? 1 : 2;
+    if (data.size() < pos + numValues * bytesPerValue)
+    {
+        *error = "pgm data is truncated";
+        return false;
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data() + pos);
+    for (size_t valueIdx = 0; valueIdx < numValues; ++valueIdx)
+    {
+        // 16-bit pgm samples are big-endian
+        const int sample = bytesPerValue == 1 ? bytes[valueIdx] : (bytes[2 * valueIdx] << 8) | bytes[2 * valueIdx + 1];
+        heightfield->values[valueIdx] = rangeMin + sample * scale;
+    }
+    return true;
+}
+
+bool writePgm(const std::string& path, int width, int height, const float* values, std::string* error)
+{
+    const size_t numValues = (size_t)width * height;
+    const auto [minIt, maxIt] = std::minmax_element(values, values + numValues);
+    const float rangeMin = numValues > 0 ? *minIt : 0.f;
+    const float rangeMax = numValues > 0 ? *maxIt : 0.f;
+    const float range = rangeMax - rangeMin;
+
+    std::ostringstream header;
+    header.precision(9);
+    header << "P5\n# " << pgmRangeComment << " " << rangeMin << " " << rangeMax << "\n" << width << " " << height << "\n65535\n";
+    const std::string headerStr = header.str();
+
+    std::vector<char> data(headerStr.begin(), headerStr.end());
+    data.reserve(data.size() + numValues * 2);
+    for (size_t valueIdx = 0; valueIdx < numValues; ++valueIdx)
+    {
+        const float normalized = range > 0.f ? (values[valueIdx] - rangeMin) / range : 0.f;
+        const int sample = std::min(65535, std::max(0, (int)(normalized * 65535.f + 0.5f)));
+        data.push_back((char)(sample >> 8));
+        data.push_back((char)(sample & 0xFF));
+    }
+    return writeFile(path, data, error);
+}
+
+// exr
+
+constexpr uint32_t exrMagic = 20000630;
+
+enum ExrPixelType
+{
+    EXR_UINT = 0,
+    EXR_HALF = 1,
+    EXR_FLOAT = 2
+};
+
+bool readExr(const std::vector<char>& data, Heightfield* heightfield, std::string* error)
+{
+    if (data.size() < 8 || readLE<uint32_t>(data.data()) != exrMagic)
+    {
+        *error = "not an exr file";
+        return false;
+    }
+
+    const uint32_t versionFlags = readLE<uint32_t>(data.data() + 4);
+    if ((versionFlags & 0xFF) != 2 || (versionFlags & 0x1A00) != 0) // tiled, deep, and multipart files are unsupported
+    {
+        *error = "only single-part scanline exr files are supported";
+        return false;
+    }
+
+    struct Channel
+    {
+        std::string name;
+        int pixelType;
+    };
+    std::vector<Channel> channels;
+    int compression = -1;
+    int32_t dataWindow[4] = { 0, 0, -1, -1 };
+
+    size_t pos = 8;
+    auto readCString = [&]() -> std::string
+    {
+        const size_t end = std::find(data.begin() + pos, data.end(), '\0') - data.begin();
+        std::string str(data.begin() + pos, data.begin() + end);
+        pos = end + 1;
+        return str;
+    };
+
+    while (pos < data.size())
+    {
+        const std::string attributeName = readCString();
+        if (attributeName.empty())
+        {
+            break;
+        }
+
+        const std::string attributeType = readCString();
+        const int32_t attributeSize = readLE<int32_t>(data.data() + pos);
+        pos += 4;
+        const size_t attributeEnd = pos + attributeSize;
+        if (attributeEnd > data.size())
+        {
+            *error = "exr header is truncated";
+            return false;
+        }
+
+        if (attributeName == "channels")
+        {
+            while (pos < attributeEnd)
+            {
+                const std::string channelName = readCString();
+                if (channelName.empty())
+                {
+                    break;
+                }
+                channels.push_back({ channelName, readLE<int32_t>(data.data() + pos) });
+                pos += 16; // pixel type, pLinear + reserved, x sampling, y sampling
+            }
+        }
+        else if (attributeName == "compression")
+        {
+            compression = (unsigned char)data[pos];
+        }
+        else if (attributeName == "dataWindow")
+        {
+            std::memcpy(dataWindow, data.data() + pos, sizeof(dataWindow));
+        }
+
+        pos = attributeEnd;
+    }
+
+    if (compression != 0)
+    {
+        *error = "only uncompressed exr files are supported";
+        return false;
+    }
+
+    if (channels.empty())
+    {
+        *error = "exr file has no channels";
+        return false;
+    }
+
+    const int width = dataWindow[2] - dataWindow[0] + 1;
+    const int height = dataWindow[3] - dataWindow[1] + 1;
+    if (width <= 0 || height <= 0)
+    {
+        *error = "invalid exr data window";
+        return false;
+    }
+
+    int selectedChannelIdx = 0;
+    for (const char* preferredName : { "height", "R", "Y" })
+    {
+        for (int channelIdx = 0; channelIdx < (int)channels.size(); ++channelIdx)
+        {
+            if (channels[channelIdx].name == preferredName)
+            {
+                selectedChannelIdx = channelIdx;
+            }
+        }
+    }
+
+    // byte offset of the selected channel within a scanline, and bytes per scanline
+    size_t channelOffset = 0;
+    size_t scanlineBytes = 0;
+    for (int channelIdx = 0; channelIdx < (int)channels.size(); ++channelIdx)
+    {
+        const size_t channelBytes = (size_t)width * (channels[channelIdx].pixelType == EXR_HALF ? 2 : 4);
+        if (channelIdx == selectedChannelIdx)
+        {
+            channelOffset = scanlineBytes;
+        }
+        scanlineBytes += channelBytes;
+    }
+
+    const int pixelType = channels[selectedChannelIdx].pixelType;
+    const size_t offsetTablePos = pos;
+    if (offsetTablePos + (size_t)height * 8 > data.size())
+    {
+        *error = "exr offset table is truncated";
+        return false;
+    }
+
+    heightfield->width = width;
+    heightfield->height = height;
+    heightfield->values.resize((size_t)width * height);
+
+    for (int chunkIdx = 0; chunkIdx < height; ++chunkIdx)
+    {
+        const uint64_t chunkPos = readLE<uint64_t>(data.data() + offsetTablePos + (size_t)chunkIdx * 8);
+        if (chunkPos + 8 + scanlineBytes > data.size())
+        {
+            *error = "exr scanline is truncated";
+            return false;
+        }
+
+        const int y = readLE<int32_t>(data.data() + chunkPos) - dataWindow[1];
+        if (y < 0 || y >= height)
+        {
+            *error = "exr scanline is outside the data window";
+            return false;
+        }
+
+        const char* src = data.data() + chunkPos + 8 + channelOffset;
+        float* dst = &heightfield->values[(size_t)y * width];
+        for (int x = 0; x < width; ++x)
+        {
+            switch (pixelType)
+            {
+            case EXR_HALF:
+                dst[x] = halfToFloat(readLE<uint16_t>(src + x * 2));
+                break;
+            case EXR_FLOAT:
+                dst[x] = readLE<float>(src + x * 4);
+                break;
+            default:
+                dst[x] = (float)readLE<uint32_t>(src + x * 4);
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool writeExr(const std::string& path, int width, int height, const float* values, std::string* error)
+{
+    std::vector<char> data;
+    appendLE<uint32_t>(&data, exrMagic);
+    appendLE<uint32_t>(&data, 2);
+
+    auto appendAttributeHeader = [&](const char* name, const char* type, int32_t size)
+    {
+        appendString(&data, name);
+        appendString(&data, type);
+        appendLE<int32_t>(&data, size);
+    };
+
+    appendAttributeHeader("channels", "chlist", 2 + 16 + 1);
+    appendString(&data, "Y");
+    appendLE<int32_t>(&data, EXR_FLOAT);
+    appendLE<uint32_t>(&data, 0); // pLinear + reserved
+    appendLE<int32_t>(&data, 1);
+    appendLE<int32_t>(&data, 1);
+    data.push_back('\0');
+
+    appendAttributeHeader("compression", "compression", 1);
+    data.push_back(0);
+
+    for (const char* windowName : { "dataWindow", "displayWindow" })
+    {
+        appendAttributeHeader(windowName, "box2i", 16);
+        appendLE<int32_t>(&data, 0);
+        appendLE<int32_t>(&data, 0);
+        appendLE<int32_t>(&data, width - 1);
+        appendLE<int32_t>(&data, height - 1);
+    }
+
+    appendAttributeHeader("lineOrder", "lineOrder", 1);
+    data.push_back(0);
+
+    appendAttributeHeader("pixelAspectRatio", "float", 4);
+    appendLE<float>(&data, 1.f);
+
+    appendAttributeHeader("screenWindowCenter", "v2f", 8);
+    appendLE<float>(&data, 0.f);
+    appendLE<float>(&data, 0.f);
+
+    appendAttributeHeader("screenWindowWidth", "float", 4);
+    appendLE<float>(&data, 1.f);
+
+    data.push_back('\0');
+
+    // one scanline per chunk: offset table, then (y, byte count, samples) per line
+    const size_t scanlineBytes = (size_t)width * sizeof(float);
+    const uint64_t firstChunkPos = data.size() + (size_t)height * 8;
+    for (int y = 0; y < height; ++y)
+    {
+        appendLE<uint64_t>(&data, firstChunkPos + (uint64_t)y * (8 + scanlineBytes));
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        appendLE<int32_t>(&data, y);
+        appendLE<int32_t>(&data, (int32_t)scanlineBytes);
+        const char* row = reinterpret_cast<const char*>(values + (size_t)y * width);
+        data.insert(data.end(), row, row + scanlineBytes);
+    }
+
+    return writeFile(path, data, error);
+}
+
+} // namespace
+
+bool Terrable::readHeightfield(const std::string& path, Heightfield* heightfield, std::string* error, int rawWidth, int rawHeight)
+{
+    std::vector<char> data;
+    if (!readFile(path, &data, error))
+    {
+        return false;
+    }
+
+    const std::string extension = getExtension(path);
+    if (extension == "raw")
+    {
+        return readRaw(data, heightfield, error, rawWidth, rawHeight);
+    }
+    if (extension == "pgm")
+    {
+        return readPgm(data, heightfield, error);
+    }
+    if (extension == "exr")
+    {
+        return readExr(data, heightfield, error);
+    }
+
+    *error = "unsupported heightfield format: " + path;
+    return false;
+}
+
+bool Terrable::writeHeightfield(const std::string& path, int width, int height, const float* values, std::string* error)
+{
+    const std::string extension = getExtension(path);
+    if (extension == "raw")
+    {
+        return writeRaw(path, width, height, values, error);
+    }
+    if (extension == "pgm")
+    {
+        return writePgm(path, width, height, values, error);
+    }
+    if (extension == "exr")
+    {
+        return writeExr(path, width, height, values, error);
+    }
+
+    *error = "unsupported heightfield format: " + path;
+    return false;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Terrable
+{
+
+struct Heightfield
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> values; // row-major, x varying fastest
+};
+
+// format is chosen by extension:
+//   .raw - little-endian float32; dimensions come from rawWidth/rawHeight, or a square is assumed from the file size
+//   .pgm - binary (P5) or ascii (P2), 8 or 16 bit; values are scaled to [0, 1] unless the file carries a range comment
+//          written by writeHeightfield
+//   .exr - single-part scanline images without compression; the first of Y, R, height or the first channel is read
+bool readHeightfield(const std::string& path, Heightfield* heightfield, std::string* error, int rawWidth = 0, int rawHeight = 0);
+
+// .raw and .exr store float32 values exactly; .pgm stores 16-bit values normalized to the data's range,
+// which is recorded in a comment so readHeightfield can restore the original scale
+bool writeHeightfield(const std::string& path, int width, int height, const float* values, std::string* error);
+
+} // namespace Terrable
@@ -0,0 +1,143 @@
+#include "layer_allocator.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace Terrable;
+
+namespace
+{
+
+size_t roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+bool isMapped(size_t size)
+{
+#if defined(__linux__)
+    return size >= hugePageSize;
+#elif defined(_WIN32)
+    return size >= hugePageSize && getHugePages() == HugePages::EXPLICIT;
+#else
+    return false;
+#endif
+}
+
+#if defined(__linux__)
+
+// maps size bytes aligned to hugePageSize by over-mapping and trimming the ends, so transparent huge pages can back
+// the whole range
+void* mapAligned(size_t size)
+{
+    const size_t mappedSize = size + hugePageSize;
+    void* mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    const uintptr_t begin = (uintptr_t)mapped;
+    const uintptr_t alignedBegin = roundUp(begin, hugePageSize);
+    if (alignedBegin > begin)
+    {
+        munmap(mapped, alignedBegin - begin);
+    }
+    const uintptr_t end = begin + mappedSize;
+    if (end > alignedBegin + size)
+    {
+        munmap((void*)(alignedBegin + size), end - (alignedBegin + size));
+    }
+    return (void*)alignedBegin;
+}
+
+#endif
+
+} // namespace
+
+HugePages Terrable::getHugePages()
+{
+    static const HugePages hugePages = []()
+    {
+        const char* forced = std::getenv("TERRABLE_HUGE_PAGES");
+        const auto nameIt = forced ? std::find(hugePageModeNames.begin(), hugePageModeNames.end(), forced) : hugePageModeNames.end();
+        return nameIt != hugePageModeNames.end() ? (HugePages)(nameIt - hugePageModeNames.begin()) : HugePages::ADVISED;
+    }();
+    return hugePages;
+}
+
+void* Terrable::allocateLayerMemory(size_t size)
+{
+    if (!isMapped(size))
+    {
+        return ::operator new(size, std::align_val_t(layerAlignment));
+    }
+
+    // mapped sizes are whole huge pages, so freeing can recompute them from the size alone
+    const size_t mappedSize = roundUp(size, hugePageSize);
+    void* data = nullptr;
+#if defined(__linux__)
+#ifdef MAP_HUGETLB
+    if (getHugePages() == HugePages::EXPLICIT)
+    {
+        data = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        data = data == MAP_FAILED ? nullptr : data;
+    }
+#endif
+    if (!data)
+    {
+        data = mapAligned(mappedSize);
+#ifdef MADV_HUGEPAGE
+        if (data && getHugePages() != HugePages::OFF)
+        {
+            madvise(data, mappedSize, MADV_HUGEPAGE);
+        }
+#endif
+    }
+#elif defined(_WIN32)
+    // large pages are committed up front and need SeLockMemoryPrivilege; without it this falls back to regular pages
+    const size_t largePageSize = GetLargePageMinimum();
+    if (largePageSize > 0)
+    {
+        data = VirtualAlloc(nullptr, roundUp(mappedSize, largePageSize), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    if (!data)
+    {
+        data = VirtualAlloc(nullptr, mappedSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+#endif
+    if (!data)
+    {
+        throw std::bad_alloc();
+    }
+    return data;
+}
+
+void Terrable::freeLayerMemory(void* data, size_t size) noexcept
+{
+    if (!data)
+    {
+        return;
+    }
+
+    if (!isMapped(size))
+    {
+        ::operator delete(data, std::align_val_t(layerAlignment));
+        return;
+    }
+
+#if defined(__linux__)
+    munmap(data, roundUp(size, hugePageSize));
+#elif defined(_WIN32)
+    VirtualFree(data, 0, MEM_RELEASE);
+#endif
+}
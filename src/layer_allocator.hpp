@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace Terrable
+{
+
+// whether large layer buffers ask for huge pages: never, by advising transparent huge pages (madvise on Linux), or as
+// explicit huge pages (MAP_HUGETLB on Linux, large pages on Windows, which needs the lock pages privilege), falling back
+// to regular pages when none are available. chosen once per process from TERRABLE_HUGE_PAGES=off|transparent|explicit
+enum class HugePages
+{
+    OFF,
+    ADVISED,
+    EXPLICIT
+};
+static constexpr int numHugePageModes = (int)HugePages::EXPLICIT + 1;
+
+static std::array<std::string, numHugePageModes> hugePageModeNames = {
+    "off",
+    "transparent",
+    "explicit"
+};
+
+HugePages getHugePages();
+
+// layer buffers start on a cache line, so every 64-byte vector load from an aligned offset stays within one line
+static constexpr size_t layerAlignment = 64;
+
+// buffers of at least this size are mapped directly and, unless huge pages are off, aligned to and backed by 2 MiB pages
+static constexpr size_t hugePageSize = (size_t)2 << 20;
+
+void* allocateLayerMemory(size_t size);
+void freeLayerMemory(void* data, size_t size) noexcept;
+
+// allocator for the layer planes. new elements are left uninitialized when a vector grows, so resizing doesn't touch the
+// pages and whoever fills them first decides (or has bound beforehand) where they live
+template <typename T>
+class LayerAllocator
+{
+public:
+    using value_type = T;
+
+    LayerAllocator() = default;
+
+    template <typename U>
+    LayerAllocator(const LayerAllocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(allocateLayerMemory(count * sizeof(T)));
+    }
+
+    void deallocate(T* data, size_t count) noexcept
+    {
+        freeLayerMemory(data, count * sizeof(T));
+    }
+
+    template <typename U>
+    void construct(U* ptr) noexcept(std::is_nothrow_default_constructible<U>::value)
+    {
+        ::new ((void*)ptr) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args)
+    {
+        ::new ((void*)ptr) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const LayerAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const LayerAllocator<U>&) const noexcept { return false; }
+};
+
+} // namespace Terrable
@@ -0,0 +1,168 @@
+#include "numa.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fstream>
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace Terrable;
+
+namespace
+{
+
+#if defined(__linux__)
+
+// sysfs lists like "0-3,8-11"
+std::vector<int> parseIdList(const std::string& list)
+{
+    std::vector<int> ids;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+
+        const std::string range = list.substr(pos, end - pos);
+        const size_t dash = range.find('-');
+        const int first = std::atoi(range.c_str());
+        const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int id = first; id <= last; ++id)
+        {
+            ids.push_back(id);
+        }
+        pos = end + 1;
+    }
+    return ids;
+}
+
+std::string readSysfsLine(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+struct NumaTopology
+{
+    std::vector<int> nodeIds;
+    std::vector<std::vector<int>> nodeCpus;
+
+    NumaTopology()
+    {
+        nodeIds = parseIdList(readSysfsLine("/sys/devices/system/node/has_memory"));
+        if (nodeIds.empty())
+        {
+            nodeIds = parseIdList(readSysfsLine("/sys/devices/system/node/online"));
+        }
+
+        for (int nodeId : nodeIds)
+        {
+            nodeCpus.push_back(parseIdList(readSysfsLine("/sys/devices/system/node/node" + std::to_string(nodeId) + "/cpulist")));
+        }
+    }
+};
+
+const NumaTopology& getTopology()
+{
+    static const NumaTopology topology;
+    return topology;
+}
+
+#endif
+
+} // namespace
+
+int Terrable::getNumaNodeCount()
+{
+#if defined(__linux__)
+    return std::max(1, (int)getTopology().nodeIds.size());
+#elif defined(_WIN32)
+    ULONG highestNode = 0;
+    return GetNumaHighestNodeNumber(&highestNode) ? (int)highestNode + 1 : 1;
+#else
+    return 1;
+#endif
+}
+
+bool Terrable::bindToNumaNode(void* data, size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    const NumaTopology& topology = getTopology();
+    if (node < 0 || node >= (int)topology.nodeIds.size())
+    {
+        return false;
+    }
+
+    const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = ((uintptr_t)data + pageSize - 1) & ~(pageSize - 1);
+    const uintptr_t end = ((uintptr_t)data + size) & ~(pageSize - 1);
+    if (end <= begin)
+    {
+        return false;
+    }
+
+    // preferred rather than strict, so a full node spills over instead of failing allocations
+    constexpr int mpolPreferred = 1;
+    constexpr unsigned mpolMfMove = 1u << 1;
+    constexpr int bitsPerWord = 8 * sizeof(unsigned long);
+    const int nodeId = topology.nodeIds[node];
+    std::vector<unsigned long> nodeMask(nodeId / bitsPerWord + 1);
+    nodeMask[nodeId / bitsPerWord] |= 1ul << (nodeId % bitsPerWord);
+    return syscall(SYS_mbind, begin, end - begin, mpolPreferred, nodeMask.data(), nodeMask.size() * bitsPerWord + 1,
+        mpolMfMove) == 0;
+#else
+    return false;
+#endif
+}
+
+bool Terrable::pinCurrentThreadToNumaNode(int node)
+{
+#if defined(__linux__)
+    const NumaTopology& topology = getTopology();
+    if (node < 0 || node >= (int)topology.nodeCpus.size())
+    {
+        return false;
+    }
+
+    // stay within the cores a taskset or cgroup already allows
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return false;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : topology.nodeCpus[node])
+    {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+        {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return CPU_COUNT(&cpus) > 0 && sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+#elif defined(_WIN32)
+    GROUP_AFFINITY affinity = {};
+    return GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask != 0
+        && SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Terrable
+{
+
+// NUMA topology and placement. on Linux this reads sysfs and calls mbind and sched_setaffinity directly, so libnuma isn't
+// needed; Windows supports thread pinning only. elsewhere the machine counts as a single node and placement does nothing.
+// nodes are numbered 0 .. getNumaNodeCount() - 1 here, whatever ids the system gives them
+
+// nodes that have memory, at least 1
+int getNumaNodeCount();
+
+// asks for the whole pages within [data, data + size) to live on node, moving any that already exist; returns false if
+// that isn't supported or failed
+bool bindToNumaNode(void* data, size_t size, int node);
+
+// restricts the calling thread to the cores of node that it is allowed to run on; returns false if that isn't supported
+// or failed
+bool pinCurrentThreadToNumaNode(int node);
+
+} // namespace Terrable
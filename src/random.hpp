@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Terrable
+{
+    // 48-bit linear congruential generator with the same recurrence as drand48, replacing SYSsrand48/SYSdrand48.
+    // unlike those it keeps its state per instance, so independent simulations don't share a sequence.
+    class Random
+    {
+    private:
+        uint64_t state;
+
+        static constexpr uint64_t multiplier = 0x5DEECE66DULL;
+        static constexpr uint64_t increment = 0xBULL;
+        static constexpr uint64_t mask = (1ULL << 48) - 1;
+
+    public:
+        explicit Random(int64_t seed = 0) { setSeed(seed); }
+
+        void setSeed(int64_t seed)
+        {
+            state = ((((uint64_t)seed) << 16) | 0x330EULL) & mask;
+        }
+
+        // uniform in [0, 1)
+        double nextDouble()
+        {
+            state = (multiplier * state + increment) & mask;
+            return (double)state / (double)(1ULL << 48);
+        }
+
+        float nextFloat() { return (float)nextDouble(); }
+    };
+}
@@ -0,0 +1,161 @@
+#include "shared_memory.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TERRABLE_HAS_POSIX_SHM
+#endif
+
+using namespace Terrable;
+
+SharedMemory::~SharedMemory()
+{
+    close();
+}
+
+SharedMemory::SharedMemory(SharedMemory&& other) noexcept
+    : name(std::move(other.name)),
+      data(std::exchange(other.data, nullptr)),
+      size(std::exchange(other.size, 0))
+{
+}
+
+SharedMemory& SharedMemory::operator=(SharedMemory&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        name = std::move(other.name);
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+    }
+    return *this;
+}
+
+#ifdef TERRABLE_HAS_POSIX_SHM
+
+namespace
+{
+
+// maps fd whole and closes it, since the mapping keeps the object alive on its own. on failure errno is mmap's, not
+// close's
+void* mapDescriptor(int fd, size_t size)
+{
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    const int mapErrno = size > 0 ? errno : EINVAL;
+    ::close(fd);
+    errno = mapErrno;
+    return mapped == MAP_FAILED ? nullptr : mapped;
+}
+
+} // namespace
+
+bool SharedMemory::create(const std::string& newName, size_t newSize, std::string* error)
+{
+    close();
+
+    const int fd = shm_open(newName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        *error = "could not create shared memory " + newName + ": " + std::strerror(errno);
+        return false;
+    }
+
+    if (ftruncate(fd, (off_t)newSize) != 0)
+    {
+        *error = "could not size shared memory " + newName + ": " + std::strerror(errno);
+        ::close(fd);
+        shm_unlink(newName.c_str());
+        return false;
+    }
+
+    data = mapDescriptor(fd, newSize);
+    if (!data)
+    {
+        *error = "could not map shared memory " + newName + ": " + std::strerror(errno);
+        shm_unlink(newName.c_str());
+        return false;
+    }
+    name = newName;
+    size = newSize;
+    return true;
+}
+
+bool SharedMemory::open(const std::string& newName, std::string* error)
+{
+    close();
+
+    const int fd = shm_open(newName.c_str(), O_RDWR, 0);
+    if (fd < 0)
+    {
+        *error = "could not open shared memory " + newName + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        *error = "could not open shared memory " + newName + ": " + std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    data = mapDescriptor(fd, (size_t)status.st_size);
+    if (!data)
+    {
+        *error = "could not map shared memory " + newName + ": " + std::strerror(errno);
+        return false;
+    }
+    name = newName;
+    size = (size_t)status.st_size;
+    return true;
+}
+
+void SharedMemory::unlink()
+{
+    if (!name.empty())
+    {
+        shm_unlink(name.c_str());
+    }
+}
+
+void SharedMemory::close()
+{
+    if (data)
+    {
+        munmap(data, size);
+    }
+    name.clear();
+    data = nullptr;
+    size = 0;
+}
+
+#else
+
+bool SharedMemory::create(const std::string& newName, size_t, std::string* error)
+{
+    *error = "could not create shared memory " + newName + ": not supported on this system";
+    return false;
+}
+
+bool SharedMemory::open(const std::string& newName, std::string* error)
+{
+    *error = "could not open shared memory " + newName + ": not supported on this system";
+    return false;
+}
+
+void SharedMemory::unlink()
+{
+}
+
+void SharedMemory::close()
+{
+}
+
+#endif
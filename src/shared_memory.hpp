@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Terrable
+{
+
+// a named POSIX shared memory object mapped into this process, so another process can map the same pages and read or
+// write them in place. names start with a slash and contain no other. unmapped when destroyed; the name stays until
+// unlink. on systems without POSIX shared memory, create and open fail
+class SharedMemory
+{
+public:
+    SharedMemory() = default;
+    ~SharedMemory();
+
+    SharedMemory(SharedMemory&& other) noexcept;
+    SharedMemory& operator=(SharedMemory&& other) noexcept;
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    // creates a new zero-filled object of size bytes, failing if the name is taken
+    bool create(const std::string& name, size_t size, std::string* error);
+
+    // maps an existing object whole, read-write
+    bool open(const std::string& name, std::string* error);
+
+    // removes the name, so the object goes away once every process has unmapped it
+    void unlink();
+
+    float* getFloats() const { return static_cast<float*>(data); }
+    size_t getSize() const { return size; }
+
+private:
+    void close();
+
+    std::string name;
+    void* data = nullptr;
+    size_t size = 0;
+};
+
+} // namespace Terrable
@@ -0,0 +1,175 @@
+#include "simd_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(TERRABLE_HAS_X86_KERNELS) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+using namespace Terrable;
+
+namespace
+{
+
+void computeHumusRowScalar(const float* bedrockRow, size_t stride, int width, float cellSize, float* humusRow)
+{
+    const float* rowDown = bedrockRow - stride;
+    const float* rowUp = bedrockRow + stride;
+
+    for (int x = 0; x < width; ++x)
+    {
+        float slopeX = (bedrockRow[x + 1] - bedrockRow[x - 1]) / (2.f * cellSize);
+        float slopeY = (rowUp[x] - rowDown[x]) / (2.f * cellSize);
+        humusRow[x] = expf(7.f * -(slopeX * slopeX + slopeY * slopeY));
+    }
+}
+
+void sumPlanesRowScalar(const float* const* planes, int numPlanes, size_t offset, int count, float* out)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        float sum = planes[0][offset + i];
+        for (int planeIdx = 1; planeIdx < numPlanes; ++planeIdx)
+        {
+            sum += planes[planeIdx][offset + i];
+        }
+        out[i] = sum;
+    }
+}
+
+void selectColorRowScalar(const float* const* planes, int numPlanes, size_t offset, int count,
+    const float (*colors)[3], float threshold, float* const* out)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        int colorIdx = 0;
+        for (int planeIdx = 0; planeIdx < numPlanes; ++planeIdx)
+        {
+            if (planes[planeIdx][offset + i] > threshold)
+            {
+                colorIdx = planeIdx + 1;
+            }
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            out[c][i] = colors[colorIdx][c];
+        }
+    }
+}
+
+#ifdef TERRABLE_HAS_X86_KERNELS
+
+enum class Isa
+{
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+Isa detectIsa()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    const bool sse42 = (info[2] & (1 << 20)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    if (!sse42)
+    {
+        return Isa::SCALAR;
+    }
+    if (!osxsave || maxLeaf < 7)
+    {
+        return Isa::SSE42;
+    }
+
+    // the OS has to save the AVX (and for AVX-512, opmask and upper ZMM) register state
+    const unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    const bool avx2 = fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    const bool avx512 = avx2 && (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    return avx512 ? Isa::AVX512 : avx2 ? Isa::AVX2 : Isa::SSE42;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return Isa::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return Isa::SSE42;
+    }
+    return Isa::SCALAR;
+#endif
+}
+
+const SimdKernels& selectKernels()
+{
+    Isa isa = detectIsa();
+
+    // allow forcing a lower instruction set, e.g. to compare variants on one machine
+    if (const char* forced = std::getenv("TERRABLE_SIMD"))
+    {
+        Isa forcedIsa = isa;
+        if (std::strcmp(forced, "scalar") == 0)
+        {
+            forcedIsa = Isa::SCALAR;
+        }
+        else if (std::strcmp(forced, "sse42") == 0)
+        {
+            forcedIsa = Isa::SSE42;
+        }
+        else if (std::strcmp(forced, "avx2") == 0)
+        {
+            forcedIsa = Isa::AVX2;
+        }
+        isa = std::min(isa, forcedIsa);
+    }
+
+    switch (isa)
+    {
+    case Isa::AVX512:
+        return getAvx512Kernels();
+    case Isa::AVX2:
+        return getAvx2Kernels();
+    case Isa::SSE42:
+        return getSse42Kernels();
+    default:
+        return getScalarKernels();
+    }
+}
+
+#else
+
+const SimdKernels& selectKernels()
+{
+    return getScalarKernels();
+}
+
+#endif
+
+} // namespace
+
+const SimdKernels& Terrable::getScalarKernels()
+{
+    static const SimdKernels kernels = { "scalar", computeHumusRowScalar, sumPlanesRowScalar, selectColorRowScalar };
+    return kernels;
+}
+
+const SimdKernels& Terrable::getSimdKernels()
+{
+    static const SimdKernels& kernels = selectKernels();
+    return kernels;
+}
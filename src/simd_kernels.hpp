@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+namespace Terrable
+{
+
+// row kernels for whole-grid passes, with SSE4.2, AVX2, and AVX-512 variants selected once at runtime by CPU detection.
+// the vector variants use a polynomial expf with a maximum relative error of 2e-7 over the range used here
+// (results below expf(-87.3) flush to 0); everything else matches the scalar code up to float rounding.
+struct SimdKernels
+{
+    const char* isaName;
+
+    // humus = expf(-7 * |grad bedrock|^2) for one row by central differences; bedrockRow[-1], bedrockRow[width] and the
+    // rows stride away must be readable (the simulation's ghost border)
+    void (*computeHumusRow)(const float* bedrockRow, size_t stride, int width, float cellSize, float* humusRow);
+
+    // out[i] = sum over planes of plane[offset + i]
+    void (*sumPlanesRow)(const float* const* planes, int numPlanes, size_t offset, int count, float* out);
+
+    // per cell, picks colors[0] and then colors[i + 1] for every plane i (ordered bottom to top) thicker than threshold,
+    // so the topmost such plane wins; writes the three channels to out[0..2]
+    void (*selectColorRow)(const float* const* planes, int numPlanes, size_t offset, int count,
+        const float (*colors)[3], float threshold, float* const* out);
+};
+
+// best variant supported by this CPU; TERRABLE_SIMD=scalar|sse42|avx2|avx512 forces a variant (if supported)
+const SimdKernels& getSimdKernels();
+
+const SimdKernels& getScalarKernels();
+#ifdef TERRABLE_HAS_X86_KERNELS
+const SimdKernels& getSse42Kernels();
+const SimdKernels& getAvx2Kernels();
+const SimdKernels& getAvx512Kernels();
+#endif
+
+} // namespace Terrable
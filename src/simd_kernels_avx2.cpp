@@ -0,0 +1,46 @@
+// compiled with AVX2 and FMA enabled; only called after CPU detection in simd_kernels.cpp
+
+#include <immintrin.h>
+
+#include "simd_kernels.hpp"
+
+namespace
+{
+
+struct VecF
+{
+    __m256 v;
+
+    static constexpr int width = 8;
+
+    static VecF load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static void store(float* p, VecF a) { _mm256_storeu_ps(p, a.v); }
+    static VecF set1(float f) { return { _mm256_set1_ps(f) }; }
+
+    static VecF add(VecF a, VecF b) { return { _mm256_add_ps(a.v, b.v) }; }
+    static VecF sub(VecF a, VecF b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    static VecF mul(VecF a, VecF b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    static VecF min(VecF a, VecF b) { return { _mm256_min_ps(a.v, b.v) }; }
+    static VecF max(VecF a, VecF b) { return { _mm256_max_ps(a.v, b.v) }; }
+
+    static VecF lessThan(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    static VecF select(VecF mask, VecF a, VecF b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+
+    static VecF round(VecF a) { return { _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) }; }
+    // 2^n for integral n in [-126, 127]
+    static VecF pow2(VecF n)
+    {
+        const __m256i exponent = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+        return { _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23)) };
+    }
+};
+
+} // namespace
+
+#include "simd_kernels_impl.hpp"
+
+const Terrable::SimdKernels& Terrable::getAvx2Kernels()
+{
+    static const SimdKernels kernels = { "avx2", computeHumusRowImpl, sumPlanesRowImpl, selectColorRowImpl };
+    return kernels;
+}
@@ -0,0 +1,46 @@
+// compiled with AVX-512F enabled; only called after CPU detection in simd_kernels.cpp
+
+#include <immintrin.h>
+
+#include "simd_kernels.hpp"
+
+namespace
+{
+
+struct VecF
+{
+    __m512 v;
+
+    static constexpr int width = 16;
+
+    static VecF load(const float* p) { return { _mm512_loadu_ps(p) }; }
+    static void store(float* p, VecF a) { _mm512_storeu_ps(p, a.v); }
+    static VecF set1(float f) { return { _mm512_set1_ps(f) }; }
+
+    static VecF add(VecF a, VecF b) { return { _mm512_add_ps(a.v, b.v) }; }
+    static VecF sub(VecF a, VecF b) { return { _mm512_sub_ps(a.v, b.v) }; }
+    static VecF mul(VecF a, VecF b) { return { _mm512_mul_ps(a.v, b.v) }; }
+    static VecF min(VecF a, VecF b) { return { _mm512_min_ps(a.v, b.v) }; }
+    static VecF max(VecF a, VecF b) { return { _mm512_max_ps(a.v, b.v) }; }
+
+    static __mmask16 lessThan(VecF a, VecF b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+    static VecF select(__mmask16 mask, VecF a, VecF b) { return { _mm512_mask_blend_ps(mask, b.v, a.v) }; }
+
+    static VecF round(VecF a) { return { _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) }; }
+    // 2^n for integral n in [-126, 127]
+    static VecF pow2(VecF n)
+    {
+        const __m512i exponent = _mm512_add_epi32(_mm512_cvtps_epi32(n.v), _mm512_set1_epi32(127));
+        return { _mm512_castsi512_ps(_mm512_slli_epi32(exponent, 23)) };
+    }
+};
+
+} // namespace
+
+#include "simd_kernels_impl.hpp"
+
+const Terrable::SimdKernels& Terrable::getAvx512Kernels()
+{
+    static const SimdKernels kernels = { "avx512", computeHumusRowImpl, sumPlanesRowImpl, selectColorRowImpl };
+    return kernels;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+// shared kernel bodies, included by each per-instruction-set translation unit after it defines VecF (and its ops)
+// inside an anonymous namespace. each of those files is compiled with its own target flags, so nothing here may be
+// an inline function shared with other translation units.
+
+#include <math.h>
+#include <stddef.h>
+
+namespace
+{
+
+// Cephes-style expf: x = n ln2 + r, exp(r) by a degree-6 polynomial, then scaled by 2^n
+inline VecF vecExp(VecF x)
+{
+    const VecF minInput = VecF::set1(-87.3f);
+    const auto underflow = VecF::lessThan(x, minInput);
+    x = VecF::max(x, minInput);
+    x = VecF::min(x, VecF::set1(88.3762626647949f));
+
+    const VecF n = VecF::round(VecF::mul(x, VecF::set1(1.44269504088896341f)));
+    VecF r = VecF::sub(x, VecF::mul(n, VecF::set1(0.693359375f)));
+    r = VecF::sub(r, VecF::mul(n, VecF::set1(-2.12194440e-4f)));
+
+    VecF p = VecF::set1(1.9875691500e-4f);
+    p = VecF::add(VecF::mul(p, r), VecF::set1(1.3981999507e-3f));
+    p = VecF::add(VecF::mul(p, r), VecF::set1(8.3334519073e-3f));
+    p = VecF::add(VecF::mul(p, r), VecF::set1(4.1665795894e-2f));
+    p = VecF::add(VecF::mul(p, r), VecF::set1(1.6666665459e-1f));
+    p = VecF::add(VecF::mul(p, r), VecF::set1(5.0000001201e-1f));
+    p = VecF::add(VecF::mul(p, VecF::mul(r, r)), VecF::add(r, VecF::set1(1.f)));
+
+    return VecF::select(underflow, VecF::set1(0.f), VecF::mul(p, VecF::pow2(n)));
+}
+
+inline float scalarHumus(float slopeX, float slopeY)
+{
+    return expf(7.f * -(slopeX * slopeX + slopeY * slopeY));
+}
+
+void computeHumusRowImpl(const float* bedrockRow, size_t stride, int width, float cellSize, float* humusRow)
+{
+    const float* rowDown = bedrockRow - stride;
+    const float* rowUp = bedrockRow + stride;
+    const float invTwoCellSize = 1.f / (2.f * cellSize);
+
+    const VecF scale = VecF::set1(invTwoCellSize);
+    const VecF negSeven = VecF::set1(-7.f);
+
+    int x = 0;
+    for (; x + VecF::width <= width; x += VecF::width)
+    {
+        const VecF slopeX = VecF::mul(VecF::sub(VecF::load(bedrockRow + x + 1), VecF::load(bedrockRow + x - 1)), scale);
+        const VecF slopeY = VecF::mul(VecF::sub(VecF::load(rowUp + x), VecF::load(rowDown + x)), scale);
+        const VecF slopeSquared = VecF::add(VecF::mul(slopeX, slopeX), VecF::mul(slopeY, slopeY));
+        VecF::store(humusRow + x, vecExp(VecF::mul(negSeven, slopeSquared)));
+    }
+
+    for (; x < width; ++x)
+    {
+        humusRow[x] = scalarHumus((bedrockRow[x + 1] - bedrockRow[x - 1]) * invTwoCellSize, (rowUp[x] - rowDown[x]) * invTwoCellSize);
+    }
+}
+
+void sumPlanesRowImpl(const float* const* planes, int numPlanes, size_t offset, int count, float* out)
+{
+    int i = 0;
+    for (; i + VecF::width <= count; i += VecF::width)
+    {
+        VecF sum = VecF::load(planes[0] + offset + i);
+        for (int planeIdx = 1; planeIdx < numPlanes; ++planeIdx)
+        {
+            sum = VecF::add(sum, VecF::load(planes[planeIdx] + offset + i));
+        }
+        VecF::store(out + i, sum);
+    }
+
+    for (; i < count; ++i)
+    {
+        float sum = planes[0][offset + i];
+        for (int planeIdx = 1; planeIdx < numPlanes; ++planeIdx)
+        {
+            sum += planes[planeIdx][offset + i];
+        }
+        out[i] = sum;
+    }
+}
+
+void selectColorRowImpl(const float* const* planes, int numPlanes, size_t offset, int count,
+    const float (*colors)[3], float threshold, float* const* out)
+{
+    const VecF thresholdVec = VecF::set1(threshold);
+
+    int i = 0;
+    for (; i + VecF::width <= count; i += VecF::width)
+    {
+        VecF channels[3] = { VecF::set1(colors[0][0]), VecF::set1(colors[0][1]), VecF::set1(colors[0][2]) };
+        for (int planeIdx = 0; planeIdx < numPlanes; ++planeIdx)
+        {
+            const auto visible = VecF::lessThan(thresholdVec, VecF::load(planes[planeIdx] + offset + i));
+            for (int c = 0; c < 3; ++c)
+            {
+                channels[c] = VecF::select(visible, VecF::set1(colors[planeIdx + 1][c]), channels[c]);
+            }
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            VecF::store(out[c] + i, channels[c]);
+        }
+    }
+
+    for (; i < count; ++i)
+    {
+        int colorIdx = 0;
+        for (int planeIdx = 0; planeIdx < numPlanes; ++planeIdx)
+        {
+            if (planes[planeIdx][offset + i] > threshold)
+            {
+                colorIdx = planeIdx + 1;
+            }
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            out[c][i] = colors[colorIdx][c];
+        }
+    }
+}
+
+} // namespace
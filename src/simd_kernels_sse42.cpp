@@ -0,0 +1,46 @@
+// compiled with SSE4.2 enabled; only called after CPU detection in simd_kernels.cpp
+
+#include <nmmintrin.h>
+
+#include "simd_kernels.hpp"
+
+namespace
+{
+
+struct VecF
+{
+    __m128 v;
+
+    static constexpr int width = 4;
+
+    static VecF load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static void store(float* p, VecF a) { _mm_storeu_ps(p, a.v); }
+    static VecF set1(float f) { return { _mm_set1_ps(f) }; }
+
+    static VecF add(VecF a, VecF b) { return { _mm_add_ps(a.v, b.v) }; }
+    static VecF sub(VecF a, VecF b) { return { _mm_sub_ps(a.v, b.v) }; }
+    static VecF mul(VecF a, VecF b) { return { _mm_mul_ps(a.v, b.v) }; }
+    static VecF min(VecF a, VecF b) { return { _mm_min_ps(a.v, b.v) }; }
+    static VecF max(VecF a, VecF b) { return { _mm_max_ps(a.v, b.v) }; }
+
+    static VecF lessThan(VecF a, VecF b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    static VecF select(VecF mask, VecF a, VecF b) { return { _mm_blendv_ps(b.v, a.v, mask.v) }; }
+
+    static VecF round(VecF a) { return { _mm_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) }; }
+    // 2^n for integral n in [-126, 127]
+    static VecF pow2(VecF n)
+    {
+        const __m128i exponent = _mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127));
+        return { _mm_castsi128_ps(_mm_slli_epi32(exponent, 23)) };
+    }
+};
+
+} // namespace
+
+#include "simd_kernels_impl.hpp"
+
+const Terrable::SimdKernels& Terrable::getSse42Kernels()
+{
+    static const SimdKernels kernels = { "sse4.2", computeHumusRowImpl, sumPlanesRowImpl, selectColorRowImpl };
+    return kernels;
+}
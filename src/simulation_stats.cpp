@@ -0,0 +1,71 @@
+#include "simulation_stats.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace Terrable;
+
+int SimulationStats::getPathLengthBin(int pathLength)
+{
+    int bin = 0;
+    while (pathLength > 0 && bin < numPathLengthBins - 1)
+    {
+        pathLength >>= 1;
+        ++bin;
+    }
+    return bin;
+}
+
+void SimulationStats::recordEvent(Event event, const CurrentEventStats& current, double seconds)
+{
+    auto& eventStats = events[(int)event];
+    ++eventStats.count;
+    eventStats.noOpCount += current.numChanges == 0 ? 1 : 0;
+    eventStats.seconds += seconds;
+    eventStats.massMoved += current.massMoved;
+    eventStats.totalPathLength += current.pathLength;
+    ++eventStats.pathLengthHistogram[getPathLengthBin(current.pathLength)];
+}
+
+void SimulationStats::merge(const SimulationStats& other)
+{
+    for (int eventIdx = 0; eventIdx < numEvents; ++eventIdx)
+    {
+        auto& eventStats = events[eventIdx];
+        const auto& otherStats = other.events[eventIdx];
+        eventStats.count += otherStats.count;
+        eventStats.noOpCount += otherStats.noOpCount;
+        eventStats.seconds += otherStats.seconds;
+        eventStats.massMoved += otherStats.massMoved;
+        eventStats.totalPathLength += otherStats.totalPathLength;
+        for (int bin = 0; bin < numPathLengthBins; ++bin)
+        {
+            eventStats.pathLengthHistogram[bin] += otherStats.pathLengthHistogram[bin];
+        }
+    }
+}
+
+std::string SimulationStats::toJson() const
+{
+    std::ostringstream json;
+    json << "{\"events\":{";
+    for (int eventIdx = 0; eventIdx < numEvents; ++eventIdx)
+    {
+        const auto& eventStats = events[eventIdx];
+        json << (eventIdx > 0 ? "," : "") << "\"" << eventNames[eventIdx] << "\":{"
+             << "\"count\":" << eventStats.count
+             << ",\"seconds\":" << eventStats.seconds
+             << ",\"ns_per_event\":" << (eventStats.count > 0 ? eventStats.seconds * 1e9 / eventStats.count : 0.0)
+             << ",\"noop_ratio\":" << eventStats.getNoOpRatio()
+             << ",\"mass_moved\":" << eventStats.massMoved
+             << ",\"mean_path_length\":" << eventStats.getMeanPathLength()
+             << ",\"path_length_histogram\":[";
+        for (int bin = 0; bin < numPathLengthBins; ++bin)
+        {
+            json << (bin > 0 ? "," : "") << eventStats.pathLengthHistogram[bin];
+        }
+        json << "]}";
+    }
+    json << "}}";
+    return json.str();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "enums.hpp"
+
+// hot-path instrumentation is only compiled in when TERRABLE_ENABLE_STATS is defined (CMake option of the same name);
+// otherwise TERRABLE_STATS(...) expands to nothing and the event code is identical to an uninstrumented build
+#ifdef TERRABLE_ENABLE_STATS
+#define TERRABLE_STATS(...) __VA_ARGS__
+#else
+#define TERRABLE_STATS(...)
+#endif
+
+namespace Terrable
+{
+
+static std::array<std::string, numEvents> eventNames = {
+    "runoff",
+    "temperature",
+    "lightning",
+    "gravity",
+    "fire"
+};
+
+// path lengths are binned by powers of two: bin 0 = 0 steps, bin i = [2^(i-1), 2^i) steps, last bin = everything longer
+static constexpr int numPathLengthBins = 16;
+
+struct EventTypeStats
+{
+    uint64_t count = 0;
+    uint64_t noOpCount = 0; // events that didn't change any layer
+    double seconds = 0.0;
+    double massMoved = 0.0; // sum of absolute changes to bedrock, rock, sand, and humus
+    uint64_t totalPathLength = 0;
+    std::array<uint64_t, numPathLengthBins> pathLengthHistogram{};
+
+    double getNoOpRatio() const { return count > 0 ? (double)noOpCount / count : 0.0; }
+    double getMeanPathLength() const { return count > 0 ? (double)totalPathLength / count : 0.0; }
+};
+
+// per-event bookkeeping filled in while a single event runs
+struct CurrentEventStats
+{
+    int pathLength = 0;
+    int numChanges = 0;
+    double massMoved = 0.0;
+};
+
+struct SimulationStats
+{
+    std::array<EventTypeStats, numEvents> events;
+
+    static constexpr bool enabled =
+#ifdef TERRABLE_ENABLE_STATS
+        true;
+#else
+        false;
+#endif
+
+    void reset() { *this = SimulationStats(); }
+    void recordEvent(Event event, const CurrentEventStats& current, double seconds);
+    void merge(const SimulationStats& other);
+
+    static int getPathLengthBin(int pathLength);
+
+    std::string toJson() const;
+};
+
+} // namespace Terrable
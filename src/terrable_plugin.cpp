@@ -2,6 +2,9 @@
 #include <UT/UT_Math.h>
 #include <UT/UT_Interrupt.h>
 #include <UT/UT_MxNoise.h>
+#include <UT/UT_ParallelUtil.h>
+#include <UT/UT_VoxelArray.h>
+#include <UT/UT_WorkBuffer.h>
 
 #include <GU/GU_Detail.h>
 #include <GU/GU_PrimPoly.h>
@@ -16,17 +19,63 @@
 #include <OP/OP_OperatorTable.h>
 #include <OP/OP_AutoLockInputs.h>
 
+#include <PY/PY_Python.h>
+
 #include <limits.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
 #include "terrable_plugin.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
 using namespace Terrable;
 
-constexpr float layerColorThreshold = 0.05f;
+// helpers for polling the nodes whose background job is running. while any node is watched, a callback in the UI's
+// event loop presses each one's hidden poll button at most ten times a second, and the button's callback recooks the
+// node on the main thread if its job has published a snapshot since. the callback takes itself out once nothing is
+// watched. without a UI nothing is watched, and every cook picks up the latest snapshot
+static const char* pollBackgroundScript = R"(
+import hou
+import time
+_terrableWatched = set()
+_terrableLastPoll = [0.0]
+def _terrablePollBackground():
+    now = time.time()
+    if now - _terrableLastPoll[0] < 0.1:
+        return
+    _terrableLastPoll[0] = now
+    for sessionId in list(_terrableWatched):
+        node = hou.nodeBySessionId(sessionId)
+        if node is None:
+            _terrableWatched.discard(sessionId)
+        else:
+            node.parm("poll_background").pressButton()
+    if not _terrableWatched:
+        hou.ui.removeEventLoopCallback(_terrablePollBackground)
+def _terrableWatch(sessionId):
+    if hou.isUIAvailable() and sessionId not in _terrableWatched:
+        if not _terrableWatched:
+            hou.ui.addEventLoopCallback(_terrablePollBackground)
+        _terrableWatched.add(sessionId)
+def _terrableUnwatch(sessionId):
+    _terrableWatched.discard(sessionId)
+)";
 
 SOP_Terrable::SOP_Terrable(OP_Network* net, const char* name, OP_Operator* op)
-    : SOP_Node(net, name, op), width(-1), height(-1), cellSize(0.f)
-{}
+    : SOP_Node(net, name, op)
+{
+    // nodes are created on the main thread, so the helpers are defined once without racing
+    static bool pollDefined = false;
+    if (!pollDefined)
+    {
+        pollDefined = true;
+        PYrunPythonStatementsAndExpectNoErrors(pollBackgroundScript, "Terrable background polling");
+    }
+}
 
+// a deleted node that is still watched is dropped by the polling callback, which can't find it any more
 SOP_Terrable::~SOP_Terrable() {}
 
 void newSopOperator(OP_OperatorTable* table)
@@ -49,6 +98,18 @@ static PRM_Name simTimeName("sim_time", "Simulation Time (years)");
 static PRM_Default simTimeDefault(1);
 static PRM_Range simTimeRange(PRM_RANGE_RESTRICTED, 0, PRM_RANGE_UI, 100);
 
+// with a budget, each cook simulates for about that long, outputs the terrain so far and continues on the next cook
+// (e.g. a frame change) until sim_time is reached; 0 runs the whole simulation in one cook
+static PRM_Name cookBudgetName("cook_budget", "Cook Budget (ms)");
+static PRM_Default cookBudgetDefault(0);
+static PRM_Range cookBudgetRange(PRM_RANGE_RESTRICTED, 0, PRM_RANGE_UI, 1000);
+
+// simulating in the background keeps cooks short: each one outputs the latest snapshot of a job running on a thread of
+// the node's own, which recooks the node as snapshots come in. parameter and input changes restart the job
+static PRM_Name backgroundName("background", "Simulate in Background");
+static PRM_Default backgroundDefault(0);
+static PRM_Name pollBackgroundName("poll_background", "Poll Background Simulation");
+
 static PRM_Name seedName("seed", "Random Seed");
 static PRM_Default seedDefault(0);
 static PRM_Range seedRange(PRM_RANGE_UI, 0, PRM_RANGE_UI, 100);
@@ -57,10 +118,102 @@ static PRM_Name lightningChanceName("lightning_chance", "Lightning Chance");
 static PRM_Default lightningChanceDefault(0.005f);
 static PRM_Range lightningChanceRange(PRM_RANGE_RESTRICTED, 0.f, PRM_RANGE_RESTRICTED, 1.f);
 
+// menu order matches BoundaryMode
+static PRM_Name boundaryName("boundary", "Boundary");
+static PRM_Default boundaryDefault(0);
+static PRM_Name boundaryItems[] = {
+    PRM_Name("clamp", "Clamp"),
+    PRM_Name("wrap", "Wrap (Tileable)"),
+    PRM_Name("open", "Open (Outflow)"),
+    PRM_Name(0)
+};
+static PRM_ChoiceList boundaryMenu(PRM_CHOICELIST_SINGLE, boundaryItems);
+
+// menu order matches DescentMode
+static PRM_Name descentName("descent", "Descent Neighbours");
+static PRM_Default descentDefault(0);
+static PRM_Name descentItems[] = {
+    PRM_Name("d4", "4 (Cardinal)"),
+    PRM_Name("d8", "8 (Cardinal and Diagonal)"),
+    PRM_Name(0)
+};
+static PRM_ChoiceList descentMenu(PRM_CHOICELIST_SINGLE, descentItems);
+
+// menu order matches EventOrder
+static PRM_Name eventOrderName("event_order", "Event Order");
+static PRM_Default eventOrderDefault(0);
+static PRM_Name eventOrderItems[] = {
+    PRM_Name("random", "Random"),
+    PRM_Name("batched", "Batched by Type and Tile"),
+    PRM_Name(0)
+};
+static PRM_ChoiceList eventOrderMenu(PRM_CHOICELIST_SINGLE, eventOrderItems);
+
+// menu order matches ExecutionMode
+static PRM_Name executionName("execution", "Execution");
+static PRM_Default executionDefault(0);
+static PRM_Name executionItems[] = {
+    PRM_Name("serial", "Serial (Reproducible)"),
+    PRM_Name("hogwild", "Hogwild (Fast Preview)"),
+    PRM_Name("deferred", "Deferred (Parallel, Reproducible per Thread Count)"),
+    PRM_Name(0)
+};
+static PRM_ChoiceList executionMenu(PRM_CHOICELIST_SINGLE, executionItems);
+
+// menu item i simulates at 1 / 2^i of the input resolution and upsamples the layer changes onto the input
+static PRM_Name previewResolutionName("preview_resolution", "Preview Resolution");
+static PRM_Default previewResolutionDefault(0);
+static PRM_Name previewResolutionItems[] = {
+    PRM_Name("full", "Full"),
+    PRM_Name("half", "1/2"),
+    PRM_Name("quarter", "1/4"),
+    PRM_Name("eighth", "1/8"),
+    PRM_Name(0)
+};
+static PRM_ChoiceList previewResolutionMenu(PRM_CHOICELIST_SINGLE, previewResolutionItems);
+
+static PRM_Name maxMassDriftName("max_mass_drift", "Max Mass Drift");
+static PRM_Default maxMassDriftDefault(1e-3f);
+static PRM_Range maxMassDriftRange(PRM_RANGE_RESTRICTED, 0.f, PRM_RANGE_UI, 0.01f);
+
+// bit i of the mask is output volume i in the order individual layers, height, color
+static PRM_Name outputMaskName("output_mask", "Output Volumes");
+static PRM_Default outputMaskDefault((1 << (numTerrainLayers + 2)) - 1);
+static PRM_Name outputMaskItems[] = {
+    PRM_Name("bedrock", "Bedrock"),
+    PRM_Name("rock", "Rock"),
+    PRM_Name("sand", "Sand"),
+    PRM_Name("humus", "Humus"),
+    PRM_Name("moisture", "Moisture"),
+    PRM_Name("vegetation", "Vegetation"),
+    PRM_Name("dead_vegetation", "Dead Vegetation"),
+    PRM_Name("height", "Height"),
+    PRM_Name("color", "Color"),
+    PRM_Name(0)
+};
+static PRM_ChoiceList outputMaskMenu(PRM_CHOICELIST_TOGGLE, outputMaskItems);
+
+static PRM_Name statsJsonName("stats_json", "Stats JSON File");
+
+// setting a trace file (or the TERRABLE_TRACE environment variable) writes a Chrome trace of each cook
+static PRM_Name traceFileName("trace_file", "Trace File");
+
 PRM_Template SOP_Terrable::myTemplateList[] = {
     PRM_Template(PRM_INT, PRM_Template::PRM_EXPORT_MIN, 1, &simTimeName, &simTimeDefault, 0, &simTimeRange),
+    PRM_Template(PRM_INT, PRM_Template::PRM_EXPORT_MIN, 1, &cookBudgetName, &cookBudgetDefault, 0, &cookBudgetRange),
+    PRM_Template(PRM_TOGGLE, 1, &backgroundName, &backgroundDefault),
+    PRM_Template(PRM_Type(PRM_CALLBACK | PRM_TYPE_INVISIBLE), 1, &pollBackgroundName, 0, 0, 0, SOP_Terrable::pollBackground),
     PRM_Template(PRM_INT, PRM_Template::PRM_EXPORT_MIN, 1, &seedName, &seedDefault, 0, &seedRange),
     PRM_Template(PRM_FLT, PRM_Template::PRM_EXPORT_MIN, 1, &lightningChanceName, &lightningChanceDefault, 0, &lightningChanceRange),
+    PRM_Template(PRM_ORD, 1, &boundaryName, &boundaryDefault, &boundaryMenu),
+    PRM_Template(PRM_ORD, 1, &descentName, &descentDefault, &descentMenu),
+    PRM_Template(PRM_ORD, 1, &eventOrderName, &eventOrderDefault, &eventOrderMenu),
+    PRM_Template(PRM_ORD, 1, &executionName, &executionDefault, &executionMenu),
+    PRM_Template(PRM_ORD, 1, &previewResolutionName, &previewResolutionDefault, &previewResolutionMenu),
+    PRM_Template(PRM_FLT, PRM_Template::PRM_EXPORT_MIN, 1, &maxMassDriftName, &maxMassDriftDefault, 0, &maxMassDriftRange),
+    PRM_Template(PRM_INT, PRM_Template::PRM_EXPORT_MIN, 1, &outputMaskName, &outputMaskDefault, &outputMaskMenu),
+    PRM_Template(PRM_FILE, 1, &statsJsonName),
+    PRM_Template(PRM_FILE, 1, &traceFileName),
 
     PRM_Template()
 };
@@ -70,67 +223,48 @@ OP_Node* SOP_Terrable::myConstructor(OP_Network* net, const char* name, OP_Opera
     return new SOP_Terrable(net, name, op);
 }
 
-unsigned SOP_Terrable::disableParms()
+int SOP_Terrable::pollBackground(void* data, int, fpreal, const PRM_Template*)
 {
+    // each snapshot recooks the node once, even while it isn't displayed and the recook is left pending. once the job
+    // has stopped and its last snapshot has been recooked, there is nothing more to poll for
+    SOP_Terrable* node = static_cast<SOP_Terrable*>(data);
+    const int snapshotCount = node->background ? node->background->getSnapshotCount() : 0;
+    if (snapshotCount > node->recookedSnapshotCount)
+    {
+        node->recookedSnapshotCount = snapshotCount;
+        node->forceRecook();
+    }
+    else if (!node->background || !node->background->getStatus().running)
+    {
+        node->setBackgroundWatched(false);
+    }
     return 0;
 }
 
-size_t SOP_Terrable::posToIndex(int x, int y, TerrainLayer layer) const
+void SOP_Terrable::setBackgroundWatched(bool watched)
 {
-    return ((int)layer * height * width) + (y * width) + x;
-}
-
-float SOP_Terrable::calculateElevation(int x, int y, TerrainLayer topLayer) const
-{
-    float elevation = 0.f;
-    for (int terrainLayerIdx = (int)TerrainLayer::BEDROCK; terrainLayerIdx <= (int)topLayer; ++terrainLayerIdx)
+    if (watched == backgroundWatched)
     {
-        elevation += terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)];
+        return;
     }
-    return elevation;
-}
-
-float SOP_Terrable::calculateSlope(int x, int y, TerrainLayer topLayer) const
-{
-    float hLeft = calculateElevation(std::max(x - 1, 0), y, topLayer);
-    float hRight = calculateElevation(std::min(x + 1, width - 1), y, topLayer);
-    float hDown = calculateElevation(x, std::max(y - 1, 0), topLayer);
-    float hUp = calculateElevation(x, std::min(y + 1, height - 1), topLayer);
+    backgroundWatched = watched;
 
-    float slopeX = (hRight - hLeft) / (2.f * cellSize);
-    float slopeY = (hUp - hDown) / (2.f * cellSize);
-
-    return sqrt(slopeX * slopeX + slopeY * slopeY);
+    UT_WorkBuffer statement;
+    statement.sprintf("%s(%d)", watched ? "_terrableWatch" : "_terrableUnwatch", getUniqueId());
+    PYrunPythonStatementsAndExpectNoErrors(statement.buffer(), "Terrable background polling");
 }
 
-float SOP_Terrable::calculateSlope(const UT_Vector2i& pos1, const UT_Vector2i& pos2, TerrainLayer topLayer) const
-{
-    float h1 = calculateElevation(pos1, topLayer);
-    float h2 = calculateElevation(pos2, topLayer);
-
-    float dx = pos2.x() - pos1.x();
-    float dy = pos2.y() - pos1.y();
-    float d = sqrtf(dx * dx + dy * dy) * cellSize;
-
-    return (h2 - h1) / d;
-}
-
-float SOP_Terrable::calculateCuravature(int x, int y) const
+unsigned SOP_Terrable::disableParms()
 {
-    return calculateSlope(x, y); // TODO: pretty sure curvature calculation is more complicated than this
+    return 0;
 }
 
-void SOP_Terrable::setTerrainSize(int newWidth, int newHeight)
+void SOP_Terrable::setTerrainSize(int newWidth, int newHeight, bool clearLayers)
 {
-    width = newWidth;
-    height = newHeight;
-    terrainLayers.clear();
-    terrainLayers.resize(numTerrainLayers * width * height);
-
     UT_Matrix4R xform;
     xform.identity();
     gdp->getBBox(bbox, xform); // not sure if providing identity matrix here does anything
-    cellSize = bbox.sizeX() / width;
+    simulation.setTerrainSize(newWidth, newHeight, bbox.sizeX() / newWidth, nullptr, MemoryPlacement::SPREAD, clearLayers);
 }
 
 bool SOP_Terrable::readTerrainLayer(GEO_PrimVolume** volume, const std::string& layerName)
@@ -153,6 +287,56 @@ bool SOP_Terrable::readTerrainLayer(GEO_PrimVolume** volume, const std::string&
     return true;
 }
 
+void SOP_Terrable::readVoxelsIntoLayers(const std::vector<std::pair<const UT_VoxelArrayF*, TerrainLayer>>& sources)
+{
+    // each task copies one row of tiles of one layer; constant tiles are expanded with a fill instead of per-voxel reads
+    const int width = simulation.getWidth();
+    const int height = simulation.getHeight();
+    const int tilesX = (width + TILESIZE - 1) / TILESIZE;
+    const int tilesY = (height + TILESIZE - 1) / TILESIZE;
+    const int numTasks = (int)sources.size() * tilesY;
+
+    UTparallelFor(UT_BlockedRange<int>(0, numTasks), [&](const UT_BlockedRange<int>& range)
+    {
+        TERRABLE_TRACE_SCOPE("read tiles");
+
+        float tileBuffer[TILESIZE * TILESIZE * TILESIZE];
+        float constantRow[TILESIZE];
+
+        for (int taskIdx = range.begin(); taskIdx != range.end(); ++taskIdx)
+        {
+            const auto& [voxels, layer] = sources[taskIdx / tilesY];
+            const int tileY = taskIdx % tilesY;
+
+            for (int tileX = 0; tileX < tilesX; ++tileX)
+            {
+                const UT_VoxelTile<float>* tile = voxels->getTile(tileX, tileY, 0);
+                const int x0 = tileX * TILESIZE;
+                const int y0 = tileY * TILESIZE;
+                const int tileWidth = std::min(tile->xres(), width - x0);
+                const int tileHeight = std::min(tile->yres(), height - y0);
+
+                if (tile->isConstant())
+                {
+                    std::fill_n(constantRow, tileWidth, (*tile)(0, 0, 0));
+                    for (int y = 0; y < tileHeight; ++y)
+                    {
+                        simulation.writeLayerRow(layer, x0, y0 + y, tileWidth, constantRow);
+                    }
+                    continue;
+                }
+
+                // only the z = 0 slice is used, which comes first in the flattened tile
+                tile->flatten(tileBuffer, 1);
+                for (int y = 0; y < tileHeight; ++y)
+                {
+                    simulation.writeLayerRow(layer, x0, y0 + y, tileWidth, tileBuffer + y * tile->xres());
+                }
+            }
+        }
+    });
+}
+
 bool SOP_Terrable::readInputLayers()
 {
     if (!gdp || !gdp->hasVolumePrimitives())
@@ -172,43 +356,49 @@ bool SOP_Terrable::readInputLayers()
 
     if (hasBedrock)
     {
-        // read existing layers and populate nonexistent layers with default values
+        // read existing layers; nonexistent layers are cleared to 0
 
         if (!readTerrainLayer(&primVolume, "bedrock"))
         {
             return false;
         }
 
-        auto& bedrockWriteHandle = primVolume->getVoxelWriteHandle();
-
-        setTerrainSize(bedrockWriteHandle->getXRes(), bedrockWriteHandle->getYRes());
+        UT_VoxelArrayReadHandleF bedrockHandle = primVolume->getVoxelHandle();
+        const int newWidth = bedrockHandle->getXRes();
+        const int newHeight = bedrockHandle->getYRes();
 
+        // keep the read handles alive until all layers have been copied
+        std::vector<UT_VoxelArrayReadHandleF> handles;
+        std::vector<std::pair<const UT_VoxelArrayF*, TerrainLayer>> sources;
         for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
         {
-            if (readTerrainLayer(&primVolume, terrainLayerNames[terrainLayerIdx]))
+            if (!readTerrainLayer(&primVolume, terrainLayerNames[terrainLayerIdx]))
             {
-                auto& layerWriteHandle = primVolume->getVoxelWriteHandle();
+                continue;
+            }
 
-                for (int y = 0; y < height; ++y)
-                {
-                    for (int x = 0; x < width; ++x)
-                    {
-                        float layerValue = layerWriteHandle->getValue(x, y, 0);
-                        terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)] = layerValue;
-                    }
-                }
+            handles.push_back(primVolume->getVoxelHandle());
+            const UT_VoxelArrayF* voxels = &*handles.back();
+            if (voxels->getXRes() != newWidth || voxels->getYRes() != newHeight)
+            {
+                return false;
             }
-            else
+
+            sources.emplace_back(voxels, (TerrainLayer)terrainLayerIdx);
+        }
+
+        // only the layers missing from the input are cleared; the output of another Terrable node has every one of them
+        setTerrainSize(newWidth, newHeight, false);
+        for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+        {
+            const bool provided = std::any_of(sources.begin(), sources.end(),
+                [&](const auto& source) { return source.second == (TerrainLayer)terrainLayerIdx; });
+            if (!provided)
             {
-                for (int y = 0; y < height; ++y)
-                {
-                    for (int x = 0; x < width; ++x)
-                    {
-                        terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)] = 0.f;
-                    }
-                }
+                simulation.clearLayer((TerrainLayer)terrainLayerIdx);
             }
         }
+        readVoxelsIntoLayers(sources);
     }
     else // hasHeight
     {
@@ -219,55 +409,21 @@ bool SOP_Terrable::readInputLayers()
             return false;
         }
 
-        auto& writeHandle = primVolume->getVoxelWriteHandle();
-
-        setTerrainSize(writeHandle->getXRes(), writeHandle->getYRes());
-
-        // set bedrock = input height
-        for (int y = 0; y < height; ++y)
-        {
-            for (int x = 0; x < width; ++x)
-            {
-                float bedrockHeight = writeHandle->getValue(x, y, 0);
-                terrainLayers[posToIndex(x, y, TerrainLayer::BEDROCK)] = bedrockHeight;
-            }
-        }
-
-        // set rock and sand = 0
-        for (int terrainLayerIdx = (int)TerrainLayer::ROCK; terrainLayerIdx <= (int)TerrainLayer::SAND; ++terrainLayerIdx)
-        {
-            for (int y = 0; y < height; ++y)
-            {
-                for (int x = 0; x < width; ++x)
-                {
-                    terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)] = 0.f;
-                }
-            }
-        }
+        UT_VoxelArrayReadHandleF heightHandle = primVolume->getVoxelHandle();
+        setTerrainSize(heightHandle->getXRes(), heightHandle->getYRes(), false);
 
-        // set humus based on bedrock slope
-        for (int y = 0; y < height; ++y)
+        // set bedrock = input height; the other layers are cleared instead, so bedrock is written only once
+        for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
         {
-            for (int x = 0; x < width; ++x)
+            if ((TerrainLayer)terrainLayerIdx != TerrainLayer::BEDROCK)
             {
-                float bedrockSlope = calculateSlope(x, y);
-                //float humusHeight = expf(-(bedrockSlope * bedrockSlope) / 0.480898346962988f);
-                float humusHeight = expf(7.f * -(bedrockSlope * bedrockSlope));
-                terrainLayers[posToIndex(x, y, TerrainLayer::HUMUS)] = humusHeight;
+                simulation.clearLayer((TerrainLayer)terrainLayerIdx);
             }
         }
+        readVoxelsIntoLayers({ { &*heightHandle, TerrainLayer::BEDROCK } });
 
-        // set moisture, vegetation, and dead vegetation = 0
-        for (int terrainLayerIdx = (int)TerrainLayer::MOISTURE; terrainLayerIdx <= (int)TerrainLayer::DEAD_VEGETATION; ++terrainLayerIdx)
-        {
-            for (int y = 0; y < height; ++y)
-            {
-                for (int x = 0; x < width; ++x)
-                {
-                    terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)] = 0.f;
-                }
-            }
-        }
+        // set humus based on bedrock slope; rock, sand, moisture, vegetation, and dead vegetation stay 0
+        simulation.initializeHumusFromBedrock(ThreadPool::getShared());
     }
 
     return true;
@@ -280,7 +436,7 @@ UT_VoxelArrayWriteHandleF SOP_Terrable::createOrReadLayerAndGetWriteHandle(const
     if (!readTerrainLayer(&primVolume, layerName))
     {
         UT_VoxelArrayF voxelArray;
-        voxelArray.size(width, height, 1);
+        voxelArray.size(simulation.getWidth(), simulation.getHeight(), 1);
 
         primVolume = GU_PrimVolume::build(gdp);
         primVolume->setVoxels(&voxelArray);
@@ -294,7 +450,7 @@ UT_VoxelArrayWriteHandleF SOP_Terrable::createOrReadLayerAndGetWriteHandle(const
     return primVolume->getVoxelWriteHandle();
 }
 
-bool SOP_Terrable::writeOutputLayers()
+bool SOP_Terrable::writeOutputLayers(const TerrainSimulation& terrain, int outputMask)
 {
     GEO_PrimVolume* heightPrim;
     if (!readTerrainLayer(&heightPrim, "height"))
@@ -302,466 +458,451 @@ bool SOP_Terrable::writeOutputLayers()
         return false;
     }
 
-    // set individual layer values, creating layers if necessary
+    // output volumes in order: individual layers (created if necessary), height, color.x, color.y, color.z
+    // volumes excluded by the mask are neither created nor written; existing ones pass through from the input
+    constexpr int heightOutputIdx = numTerrainLayers;
+    constexpr int colorOutputIdx = numTerrainLayers + 1;
+    constexpr int numOutputs = numTerrainLayers + 4;
+
+    const int width = terrain.getWidth();
+    const int height = terrain.getHeight();
+
+    const bool writeColor = (outputMask & (1 << (numTerrainLayers + 1))) != 0;
+
+    std::vector<UT_VoxelArrayWriteHandleF> handles;
+    std::array<UT_VoxelArrayF*, numOutputs> outputs{};
     for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
     {
-        const auto& layerName = terrainLayerNames[terrainLayerIdx];
-        auto& layerWriteHandle = createOrReadLayerAndGetWriteHandle(layerName, heightPrim);
-
-        for (int y = 0; y < height; ++y)
+        if (outputMask & (1 << terrainLayerIdx))
         {
-            for (int x = 0; x < width; ++x)
-            {
-                layerWriteHandle->setValue(x, y, 0, terrainLayers[posToIndex(x, y, (TerrainLayer)(terrainLayerIdx))]);
-            }
+            handles.push_back(createOrReadLayerAndGetWriteHandle(terrainLayerNames[terrainLayerIdx], heightPrim));
+            outputs[terrainLayerIdx] = &*handles.back();
+        }
+    }
+    if (outputMask & (1 << numTerrainLayers))
+    {
+        handles.push_back(heightPrim->getVoxelWriteHandle());
+        outputs[heightOutputIdx] = &*handles.back();
+    }
+    if (writeColor)
+    {
+        const char* suffixes[] = { "x", "y", "z" };
+        for (int i = 0; i < 3; ++i)
+        {
+            handles.push_back(createOrReadLayerAndGetWriteHandle(std::string("color.") + suffixes[i], heightPrim));
+            outputs[colorOutputIdx + i] = &*handles.back();
         }
     }
 
-    // set height (combined height of bedrock and granular materials)
-    auto& heightWriteHandle = heightPrim->getVoxelWriteHandle();
-    for (int y = 0; y < height; ++y)
+    for (UT_VoxelArrayF* output : outputs)
     {
-        for (int x = 0; x < width; ++x)
+        if (output && (output->getXRes() != width || output->getYRes() != height || output->getZRes() != 1))
         {
-            heightWriteHandle->setValue(x, y, 0, calculateElevation(x, y));
+            return false;
         }
     }
 
-    // set color
-    const std::string suffixes[] = {"x", "y", "z"};
-    for (int i = 0; i < 3; ++i)
+    if (handles.empty())
+    {
+        return true;
+    }
+
+    // single pass over all tiles: each cell's height and top visible layer are computed once and whole tiles are written to every output
+    const int tilesX = (width + TILESIZE - 1) / TILESIZE;
+    const int tilesY = (height + TILESIZE - 1) / TILESIZE;
+
+    UTparallelFor(UT_BlockedRange<int>(0, tilesX * tilesY), [&](const UT_BlockedRange<int>& range)
     {
-        const auto& suffix = suffixes[i];
-        const std::string colorLayerName = "color." + suffix;
-        auto& colorWriteHandle = createOrReadLayerAndGetWriteHandle(colorLayerName, heightPrim);
+        TERRABLE_TRACE_SCOPE("write tiles");
 
-        for (int y = 0; y < height; ++y)
+        float tileBuffers[numOutputs][TILESIZE * TILESIZE];
+
+        for (int tileIdx = range.begin(); tileIdx != range.end(); ++tileIdx)
         {
-            for (int x = 0; x < width; ++x)
+            const int tileX = tileIdx % tilesX;
+            const int tileY = tileIdx / tilesX;
+            const int x0 = tileX * TILESIZE;
+            const int y0 = tileY * TILESIZE;
+            const int tileWidth = std::min(TILESIZE, width - x0);
+            const int tileHeight = std::min(TILESIZE, height - y0);
+            const int tileSize = tileWidth * tileHeight;
+
+            for (int y = 0; y < tileHeight; ++y)
             {
-                for (int terrainLayerIdx = (int)TerrainLayer::HUMUS; terrainLayerIdx >= (int)TerrainLayer::BEDROCK; --terrainLayerIdx)
+                const int bufferIdx = y * tileWidth;
+
+                for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
                 {
-                    TerrainLayer terrainLayer = (TerrainLayer)terrainLayerIdx;
-                    if (terrainLayers[posToIndex(x, y, terrainLayer)] > layerColorThreshold || terrainLayer == TerrainLayer::BEDROCK)
-                    {
-                        const auto& col = terrainLayerColors[terrainLayerIdx];
-                        colorWriteHandle->setValue(x, y, 0, col[i]);
-                        break;
-                    }
+                    terrain.readLayerRow((TerrainLayer)terrainLayerIdx, x0, y0 + y, tileWidth, tileBuffers[terrainLayerIdx] + bufferIdx);
+                }
+
+                std::array<float*, 3> colorRow{};
+                if (writeColor)
+                {
+                    colorRow = { tileBuffers[colorOutputIdx] + bufferIdx, tileBuffers[colorOutputIdx + 1] + bufferIdx, tileBuffers[colorOutputIdx + 2] + bufferIdx };
+                }
+                terrain.writeSurfaceRow(x0, y0 + y, tileWidth, tileBuffers[heightOutputIdx] + bufferIdx, colorRow);
+            }
+
+            for (int outputIdx = 0; outputIdx < numOutputs; ++outputIdx)
+            {
+                if (!outputs[outputIdx])
+                {
+                    continue;
+                }
+
+                // uniform tiles (e.g. all-zero moisture) are stored as a single constant value; others may still compress per the volume's options
+                UT_VoxelTile<float>* tile = outputs[outputIdx]->getTile(tileX, tileY, 0);
+                const float* tileBuffer = tileBuffers[outputIdx];
+                if (std::all_of(tileBuffer + 1, tileBuffer + tileSize, [&](float value) { return value == tileBuffer[0]; }))
+                {
+                    tile->makeConstant(tileBuffer[0]);
+                }
+                else
+                {
+                    tile->writeData(tileBuffer, 1);
+                    tile->tryCompress(outputs[outputIdx]->getCompressionOptions());
                 }
             }
         }
-    }
+    });
 
     return true;
 }
 
-void SOP_Terrable::stepSimulation(OP_Context& context)
+void SOP_Terrable::writeStatsAttributes(const SimulationStats& stats)
 {
-    int numEventsToSimulate = width * height * numEvents;
-    for (int i = 0; i < numEventsToSimulate; ++i)
+    for (int eventIdx = 0; eventIdx < numEvents; ++eventIdx)
     {
-        int x = SYSdrand48() * width;
-        int y = SYSdrand48() * height;
-        Event event = (Event)(SYSdrand48() * numEvents);
-        simulateEvent(context, x, y, event);
-    }
-}
-
-void SOP_Terrable::simulateEvent(OP_Context& context, int x, int y, Event event)
-{
-    switch (event)
-    {
-    case Event::RUNOFF:
-        simulateRunoffEvent(context, x, y);
-        break;
-    case Event::TEMPERATURE:
-        simulateTemperatureEvent(context, x, y);
-        break;
-    case Event::LIGHTNING:
-        simulateLightningEvent(context, x, y);
-        break;
-    case Event::GRAVITY:
-        simulateGravityEvent(context, x, y);
-        break;
-    case Event::FIRE:
-        simulateFireEvent(context, x, y);
-        break;
-    }
-}
+        const auto& eventStats = stats.events[eventIdx];
+        const std::string prefix = "terrable_" + eventNames[eventIdx] + "_";
 
-// TODO: make these into editable node parameters
-constexpr float bedrockSoftness = 0.004f; // higher = more erosion
-constexpr float bedrockSedimentShieldingFactor = 1.2f; // higher = more shielding
-constexpr float rockSoftness = 0.008f;
+        GA_RWHandleI countHandle(gdp->addIntTuple(GA_ATTRIB_DETAIL, (prefix + "count").c_str(), 1));
+        countHandle.set(GA_Offset(0), (int)eventStats.count);
 
-constexpr float rockDepositionConstant = 0.8f; // higher = more deposition
-constexpr float sandDepositionConstant = 0.7f;
-constexpr float humusDepositionConstant = 0.6f;
+        GA_RWHandleF secondsHandle(gdp->addFloatTuple(GA_ATTRIB_DETAIL, (prefix + "seconds").c_str(), 1));
+        secondsHandle.set(GA_Offset(0), (float)eventStats.seconds);
 
-constexpr float sedimentCapacityConstant = 0.01f; // higher = more sediment transported
+        GA_RWHandleF noOpRatioHandle(gdp->addFloatTuple(GA_ATTRIB_DETAIL, (prefix + "noop_ratio").c_str(), 1));
+        noOpRatioHandle.set(GA_Offset(0), (float)eventStats.getNoOpRatio());
 
-constexpr float rockMoistureCapacity = 0.02f;
-constexpr float sandMoistureCapacity = 0.05f;
-constexpr float humusMoistureCapacity = 0.20f;
+        GA_RWHandleF massMovedHandle(gdp->addFloatTuple(GA_ATTRIB_DETAIL, (prefix + "mass_moved").c_str(), 1));
+        massMovedHandle.set(GA_Offset(0), (float)eventStats.massMoved);
 
-constexpr float soilMoistureAbsorptionRate = 0.12f;
+        GA_RWHandleF meanPathLengthHandle(gdp->addFloatTuple(GA_ATTRIB_DETAIL, (prefix + "mean_path_length").c_str(), 1));
+        meanPathLengthHandle.set(GA_Offset(0), (float)eventStats.getMeanPathLength());
 
-constexpr float sourceMoistureReduction = 0.5f;
-
-void SOP_Terrable::applyTerrainLayerChanges(const std::vector<TerrainLayerChange>& terrainLayerChanges)
-{
-    for (const auto& change : terrainLayerChanges)
-    {
-        terrainLayers[posToIndex(change.pos, change.layer)] += change.change;
+        GA_RWHandleI histogramHandle(gdp->addIntTuple(GA_ATTRIB_DETAIL, (prefix + "path_length_histogram").c_str(), numPathLengthBins));
+        for (int bin = 0; bin < numPathLengthBins; ++bin)
+        {
+            histogramHandle.set(GA_Offset(0), bin, (int)eventStats.pathLengthHistogram[bin]);
+        }
     }
 }
 
-bool SOP_Terrable::calculateNextPosFromSlope(const UT_Vector2i& thisPos, UT_Vector2i* nextPos, float* slope, TerrainLayer topLayer)
+OP_ERROR SOP_Terrable::cookMySop(OP_Context& context)
 {
-    std::vector<std::pair<UT_Vector2i, float>> nextPosCandidates;
-
-    float totalSlope = 0.f;
-    for (const auto& cardinalDirection : cardinalDirections)
-    {
-        UT_Vector2i nextPosCandidate = thisPos + cardinalDirection;
-        if (nextPosCandidate.x() < 0 || nextPosCandidate.x() >= width ||
-            nextPosCandidate.y() < 0 || nextPosCandidate.y() >= height)
-        {
-            continue;
-        }
-
-        float slope = calculateSlope(thisPos, nextPosCandidate, topLayer);
-        if (slope >= 0.f)
-        {
-            continue;
-        }
+    // the node's trace file takes precedence over TERRABLE_TRACE
+    UT_String tracePath = getStringParam(traceFileName, context);
+    const char* envTracePath = Tracer::getEnvPath();
+    const bool tracing = (tracePath.isstring() || envTracePath) &&
+        Tracer::start(tracePath.isstring() ? (const char*)tracePath : envTracePath, Tracer::getEnvDetail());
 
-        slope = -slope; // make it positive
-        nextPosCandidates.emplace_back(nextPosCandidate, slope);
-        totalSlope += slope;
-    }
-
-    if (nextPosCandidates.empty())
     {
-        return false;
+        TERRABLE_TRACE_SCOPE("cook");
+        cookSimulation(context);
     }
 
-    float rand = SYSdrand48() * totalSlope;
-    for (const auto& [nextPosCandidate, nextPosSlope] : nextPosCandidates)
+    if (tracing)
     {
-        if (rand < nextPosSlope)
+        std::string traceError;
+        if (!Tracer::stop(&traceError))
         {
-            *nextPos = nextPosCandidate;
-            *slope = nextPosSlope;
-            return true;
+            addWarning(SOP_MESSAGE, traceError.c_str());
         }
-
-        rand -= nextPosSlope;
     }
 
-    return false;
+    return error();
 }
 
-void SOP_Terrable::simulateRunoffEvent(OP_Context& context, int x, int y)
+OP_ERROR SOP_Terrable::cookSimulation(OP_Context& context)
 {
-    std::vector<TerrainLayerChange> terrainLayerChanges;
+    OP_AutoLockInputs inputs(this);
+    if (inputs.lock(context) >= UT_ERROR_ABORT)
+    {
+        return error();
+    }
 
-    // TODO: set initial water based on rainfall
-    // TODO: reduce initial water amount proportionally to plant density (water intercepted by plants and released to the atmosphere through evaporation)
-    float currentWater = 1.6f;
-    float carriedRock = 0.f;
-    float carriedSand = 0.f;
-    float carriedHumus = 0.f;
+    UT_Interrupt* boss = UTgetInterrupt();
+    if (!boss->opStart("running Terrable simulation"))
+    {
+        boss->opEnd();
+        return error();
+    }
 
-    UT_Vector2i sourcePos(x, y);
+    // reading the input counts towards the budget, writing the output doesn't
+    const int cookBudgetMs = getIntParam(cookBudgetName, context);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(cookBudgetMs);
 
-    UT_Vector2i thisPos = sourcePos;
-    UT_Vector2i nextPos;
-    float nextPosSlope;
-    while (true)
-    {
-        bool foundNextPos = calculateNextPosFromSlope(thisPos, &nextPos, &nextPosSlope);
+    duplicateSource(0, context); // duplicate input geometry
 
-        if (!foundNextPos || currentWater <= 0.f) // reached terrain local minimum or ran out of water
-        {
-            // TODO: what happens to excess water?
-            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::ROCK, carriedRock);
-            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::SAND, carriedSand);
-            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::HUMUS, carriedHumus);
-            break;
-        }
+    // params first, since humus initialization on input already depends on the boundary mode
+    SimulationParams params;
+    params.lightningChance = getFloatParam(lightningChanceName, context);
+    params.boundaryMode = (BoundaryMode)std::clamp(getIntParam(boundaryName, context), 0, numBoundaryModes - 1);
+    params.descentMode = (DescentMode)std::clamp(getIntParam(descentName, context), 0, numDescentModes - 1);
+    params.eventOrder = (EventOrder)std::clamp(getIntParam(eventOrderName, context), 0, numEventOrders - 1);
+    params.executionMode = (ExecutionMode)std::clamp(getIntParam(executionName, context), 0, numExecutionModes - 1);
+    params.maxMassDrift = getFloatParam(maxMassDriftName, context);
+    simulation.setParams(params);
 
-        float thisRock = terrainLayers[posToIndex(thisPos, TerrainLayer::ROCK)];
-        float thisSand = terrainLayers[posToIndex(thisPos, TerrainLayer::SAND)];
-        float thisHumus = terrainLayers[posToIndex(thisPos, TerrainLayer::HUMUS)];
+    int simTimeYears = getIntParam(simTimeName, context);
 
-        float thisMoistureCapacity =
-            thisRock * rockMoistureCapacity +
-            thisSand * sandMoistureCapacity +
-            thisHumus * humusMoistureCapacity;
-        float thisMoisture = terrainLayers[posToIndex(thisPos, TerrainLayer::MOISTURE)];
+    // the input counts as unchanged while its detail is the same one, at the same version
+    const GU_Detail* input = inputGeo(0, context);
+    SimulationSource source;
+    source.inputId = input ? input->getUniqueId() : -1;
+    source.inputVersion = input ? input->getMetaCacheCount() : -1;
+    source.params = params;
+    source.seed = getIntParam(seedName, context);
+    source.previewFactor = 1 << std::clamp(getIntParam(previewResolutionName, context), 0, 3);
 
-        float soilAbsorption = fmin(soilMoistureAbsorptionRate / nextPosSlope, thisMoistureCapacity - thisMoisture);
-        soilAbsorption = fmin(soilAbsorption, currentWater);
-        currentWater -= soilAbsorption;
-        terrainLayerChanges.emplace_back(thisPos, TerrainLayer::MOISTURE, +soilAbsorption);
+    if (getIntParam(backgroundName, context))
+    {
+        cookBackground(context, source, simTimeYears);
+        boss->opEnd();
+        return error();
+    }
+    background.reset();
+    setBackgroundWatched(false);
 
-        float currentSedimentCapacity = currentWater * sedimentCapacityConstant;
+    const int previewFactor = source.previewFactor;
+    TerrainSimulation& steppedSimulation = previewFactor > 1 ? previewSimulation : simulation;
+    const bool continuing = cookBudgetMs > 0 && progress.valid && progress.source == source
+        && progress.yearsDone <= simTimeYears;
 
-        float currentSediment = carriedRock + carriedSand + carriedHumus;
-        if (currentSediment > currentSedimentCapacity)
+    // a preview's change is added to the layers as read, so they are read again on every cook
+    if (!continuing || previewFactor > 1)
+    {
+        bool readSucceeded;
         {
-            float excessSedimentRatio = (currentSediment - currentSedimentCapacity) / currentSediment;
-
-            if (carriedRock > 0.f)
-            {
-                float rockDeposition = carriedRock * excessSedimentRatio * rockDepositionConstant;
-                carriedRock -= rockDeposition;
-                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::ROCK, rockDeposition);
-            }
+            TERRABLE_TRACE_SCOPE("read input");
+            readSucceeded = readInputLayers();
+        }
 
-            if (carriedSand > 0.f)
-            {
-                float sandDeposition = carriedSand * excessSedimentRatio * sandDepositionConstant;
-                carriedSand -= sandDeposition;
-                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::SAND, sandDeposition);
-            }
+        if (!readSucceeded)
+        {
+            progress = Progress();
+            addWarning(SOP_MESSAGE, "failed reading input layers");
+            boss->opEnd();
+            return error();
+        }
+    }
 
-            if (carriedHumus > 0.f)
-            {
-                float humusDeposition = carriedHumus * excessSedimentRatio * humusDepositionConstant;
-                carriedHumus -= humusDeposition;
-                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::HUMUS, humusDeposition);
-            }
+    if (!continuing)
+    {
+        if (previewFactor > 1)
+        {
+            previewInitial.downsampleFrom(simulation, previewFactor);
+            previewSimulation.downsampleFrom(simulation, previewFactor);
         }
         else
         {
-            // TODO: dampen by vegetation amount
-            float excessSedimentCapacity = currentSedimentCapacity - currentSediment;
-
-            if (thisRock > 0.f)
-            {
-                float rockErosion = fmin(thisRock, excessSedimentCapacity) * rockSoftness;
-                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::ROCK, -rockErosion);
-                carriedSand += rockErosion;
-                excessSedimentCapacity = fmax(0.f, excessSedimentCapacity - rockErosion);
-            }
-
-            float thisSediment = thisRock + thisSand + thisHumus;
-            float bedrockErosionFactor = 1.f / (1.f + bedrockSedimentShieldingFactor * thisSediment);
-            float bedrockErosion = excessSedimentCapacity * bedrockErosionFactor * bedrockSoftness;
-            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::BEDROCK, -bedrockErosion);
-            carriedRock += bedrockErosion;
+            previewInitial = TerrainSimulation();
+            previewSimulation = TerrainSimulation();
         }
 
-        thisPos = nextPos;
-    }
-
-    applyTerrainLayerChanges(terrainLayerChanges);
+        steppedSimulation.setSeed(source.seed);
+        steppedSimulation.resetStats();
 
-    // "Once the runoff sequence terminates we approximate the effects of plant transpiration and seepage into groundwater
-    // by reducing the moisture at the source p0 by a constant amount."
-    float& sourceMoisture = terrainLayers[posToIndex(sourcePos, TerrainLayer::MOISTURE)];
-    sourceMoisture = fmax(sourceMoisture - sourceMoistureReduction, 0.f);
-}
-
-void SOP_Terrable::simulateTemperatureEvent(OP_Context& context, int x, int y)
-{
-    // TODO
-}
-
-// TODO: make these into editable node parameters
-constexpr float k_l_c = 1.2f; // curvature scaling factor
-constexpr float k_l_s = 2.0f; // minimum curvature for which maximum lightning chance is achieved
-constexpr float lightningBedrockToRemove = 0.4f;
-
-void SOP_Terrable::simulateLightningEvent(OP_Context& context, int x, int y)
-{
-    fpreal now = context.getTime();
-
-    std::vector<TerrainLayerChange> terrainLayerChanges;
-
-    UT_Vector2i sourcePos = { x, y };
-
-    UT_Vector2i thisPos = sourcePos;
-
-    // float thisBedrock = terrainLayers[posToIndex(thisPos, TerrainLayer::BEDROCK)];
-    float thisRock = terrainLayers[posToIndex(thisPos, TerrainLayer::ROCK)];
-    float thisSand = terrainLayers[posToIndex(thisPos, TerrainLayer::SAND)];
-    float thisVegetation = terrainLayers[posToIndex(thisPos, TerrainLayer::VEGETATION)];
-    float thisDeadVegetation = terrainLayers[posToIndex(thisPos, TerrainLayer::DEAD_VEGETATION)];
-
-    std::vector<std::pair<UT_Vector2i, float>> nextPosCandidates;
-
-    float localCurvature = calculateCuravature(x, y);
-
-    // k_L = maximum probability that lightning strikes at that cell
-    float k_L = getFloatParam(lightningChanceName, context);
-
-    // lp = probability of damage
-    float lp = k_L * fmin(1.f, expf(k_l_c * (localCurvature - k_l_s)));
-
-    float r = SYSdrand48(); // get a random float between 0 and 1
-
-    // damage done
-    if (r < lp) {
-        // TODO: destroy vegetation if present and exit early accordingly
-        //       based on the paper's wording, it seems like no damage is done to bedrock if vegetation is destroyed by lightning
-
-        // obtain 4 directly surrounding coords
-        std::vector<UT_Vector2i> nextPosCandidates;
-        nextPosCandidates.emplace_back(thisPos);
+        progress = Progress();
+        progress.valid = cookBudgetMs > 0;
+        progress.source = source;
+    }
 
-        for (const auto& cardinalDirection : cardinalDirections)
+    // interrupts are checked every few thousand events; an interrupted cook still outputs the terrain reached so far.
+    // the budget is checked just as often, and a year it stops partway is continued by the next cook
+    bool interrupted = false;
+    bool budgetSpent = false;
+    while (progress.yearsDone < simTimeYears && !interrupted && !budgetSpent)
+    {
+        TERRABLE_TRACE_SCOPE("year", "year", progress.yearsDone);
+        const bool yearCompleted = steppedSimulation.stepSimulation([&](float yearProgress)
+        {
+            interrupted = boss->opInterrupt((int)(((progress.yearsDone + yearProgress) * 100.f) / simTimeYears));
+            budgetSpent = cookBudgetMs > 0 && std::chrono::steady_clock::now() >= deadline;
+            return !interrupted && !budgetSpent;
+        });
+        if (yearCompleted)
         {
-            UT_Vector2i nextPosCandidate = thisPos + cardinalDirection;
-            if (nextPosCandidate.x() < 0 || nextPosCandidate.x() >= width ||
-                nextPosCandidate.y() < 0 || nextPosCandidate.y() >= height)
+            ++progress.yearsDone;
+            if (steppedSimulation.getLastMassDrift() > params.maxMassDrift)
             {
-                continue;
+                ++progress.driftFallbackYears;
             }
-            nextPosCandidates.emplace_back(nextPosCandidate);
         }
+    }
 
-        // spread granular materials to 4 directly surrounding coords
-        for (UT_Vector2i candidate : nextPosCandidates)
-        {
-            float r2 = SYSdrand48(); // get a random float between 0 and 1
-            if (r2 > 0.3f) {
-                terrainLayerChanges.emplace_back(candidate, TerrainLayer::ROCK, lightningBedrockToRemove * 0.25f);
-            }
-            else {
-                terrainLayerChanges.emplace_back(candidate, TerrainLayer::SAND, lightningBedrockToRemove * 0.25f);
-            }
-            break;
-        }
+    const float yearsSimulated = progress.yearsDone + steppedSimulation.getYearProgress();
 
-        // remove bedrock in current coord
-        terrainLayerChanges.emplace_back(thisPos, TerrainLayer::BEDROCK, -lightningBedrockToRemove);
-    }
+    // an unfinished progressive simulation recooks on the next frame change. a finished one clears that again, or every
+    // frame change would recook only to output the same terrain
+    const bool unfinished = progress.valid && progress.yearsDone < simTimeYears;
+    flags().setTimeDep(unfinished);
 
-    // make all changes
-    applyTerrainLayerChanges(terrainLayerChanges);
-}
+    if (!writeResult(context, steppedSimulation, previewFactor, yearsSimulated))
+    {
+        boss->opEnd();
+        return error();
+    }
 
-// TODO: make these into editable node parameters
-constexpr float rockFrictionAngleDegrees = 22.f;
-constexpr float sandFrictionAngleDegrees = 18.f;
-constexpr float humusFrictionAngleDegrees = 16.f;
+    if (progress.driftFallbackYears > 0)
+    {
+        UT_WorkBuffer message;
+        message.sprintf("hogwild mass drift exceeded the limit in %d years, which were finished serially", progress.driftFallbackYears);
+        addWarning(SOP_MESSAGE, message.buffer());
+    }
 
-void SOP_Terrable::simulateGravityEvent(OP_Context& context, int x, int y)
-{
-    float rand = SYSdrand48();
-    TerrainLayer terrainLayer;
-    float frictionAngleDegrees;
-    if (rand < 0.333333333333333f)
+    if (interrupted)
     {
-        terrainLayer = TerrainLayer::ROCK;
-        frictionAngleDegrees = rockFrictionAngleDegrees;
+        UT_WorkBuffer message;
+        message.sprintf("simulation interrupted after %.2f of %d years; output is partial%s", yearsSimulated, simTimeYears,
+            unfinished ? " until the next cook continues it" : "");
+        addWarning(SOP_MESSAGE, message.buffer());
     }
-    else if (rand < 0.666666666666666f)
+    else if (unfinished)
     {
-        terrainLayer = TerrainLayer::SAND;
-        frictionAngleDegrees = sandFrictionAngleDegrees;
+        UT_WorkBuffer message;
+        message.sprintf("simulated %.2f of %d years; the next cook continues", yearsSimulated, simTimeYears);
+        addMessage(SOP_MESSAGE, message.buffer());
     }
-    else
+
+    boss->opEnd();
+    return error();
+}
+
+void SOP_Terrable::cookBackground(OP_Context& context, const SimulationSource& source, int simTimeYears)
+{
+    // the background job takes over the preview planes, so a progressive run has to start over afterwards, and until
+    // then frame changes have nothing to continue
+    progress = Progress();
+    flags().setTimeDep(false);
+
+    // the thread only publishes snapshots; pollBackground recooks the node for them from the main thread
+    if (!background)
     {
-        terrainLayer = TerrainLayer::HUMUS;
-        frictionAngleDegrees = humusFrictionAngleDegrees;
+        background = std::make_unique<BackgroundSimulation>();
+        recookedSnapshotCount = 0;
     }
 
-    std::vector<TerrainLayerChange> terrainLayerChanges;
+    const bool restart = background->getStatus().jobId == 0 || backgroundSource != source
+        || backgroundYears != simTimeYears;
 
-    UT_Vector2i thisPos(x, y);
-    UT_Vector2i nextPos;
-    float nextPosSlope;
-    while (true)
+    // starting a job needs the input; so does a preview, whose change is added to it
+    if (restart || source.previewFactor > 1)
     {
-        float thisSediment = terrainLayers[posToIndex(thisPos, terrainLayer)];
-        if (thisSediment <= 0.f || !calculateNextPosFromSlope(thisPos, &nextPos, &nextPosSlope, terrainLayer))
+        bool readSucceeded;
         {
-            break;
+            TERRABLE_TRACE_SCOPE("read input");
+            readSucceeded = readInputLayers();
         }
 
-        // TODO: increase friction angle based on vegetation
-        float frictionHeight = tanf(SYSdegToRad(frictionAngleDegrees)) * cellSize;
-
-        float thisElevation = calculateElevation(thisPos, terrainLayer);
-        float nextElevation = calculateElevation(nextPos, terrainLayer);
-        float heightGap = thisElevation - nextElevation;
-        if (heightGap < frictionHeight)
+        if (!readSucceeded)
         {
-            break;
+            background->cancel();
+            backgroundYears = -1;
+            addWarning(SOP_MESSAGE, "failed reading input layers");
+            return;
         }
+    }
 
-        // TODO: additional contribution proportional to curvature
-        float sedimentToMove = fmin(heightGap - frictionHeight, thisSediment) * SYSdrand48();
-
-        terrainLayerChanges.emplace_back(thisPos, terrainLayer, -sedimentToMove);
-        terrainLayerChanges.emplace_back(nextPos, terrainLayer, sedimentToMove);
-
-        // TODO: destroy vegetation
+    if (restart)
+    {
+        auto job = std::make_unique<TerrainSimulation>();
+        if (source.previewFactor > 1)
+        {
+            previewInitial.downsampleFrom(simulation, source.previewFactor);
+            job->downsampleFrom(simulation, source.previewFactor);
+        }
+        else
+        {
+            *job = simulation;
+        }
+        job->setSeed(source.seed);
+        job->resetStats();
 
-        thisPos = nextPos;
+        background->start(std::move(job), simTimeYears);
+        backgroundSource = source;
+        backgroundYears = simTimeYears;
+        setBackgroundWatched(true);
     }
 
-    applyTerrainLayerChanges(terrainLayerChanges);
-}
+    // until the job publishes its first snapshot, the input passes through as read
+    const BackgroundSimulation::Status status = background->getStatus();
+    recookedSnapshotCount = std::max(recookedSnapshotCount, status.snapshotCount);
+    const TerrainSimulation& steppedSimulation = status.snapshot ? *status.snapshot
+        : source.previewFactor > 1 ? previewInitial : simulation;
+    if (!writeResult(context, steppedSimulation, source.previewFactor, status.snapshotYears))
+    {
+        return;
+    }
 
-void SOP_Terrable::simulateFireEvent(OP_Context& context, int x, int y)
-{
-    // TODO
+    UT_WorkBuffer message;
+    if (status.running)
+    {
+        message.sprintf("simulating in the background: %.2f of %d years done, showing %.2f", status.yearsSimulated,
+            simTimeYears, status.snapshotYears);
+    }
+    else
+    {
+        message.sprintf("simulated %d years in the background", simTimeYears);
+    }
+    addMessage(SOP_MESSAGE, message.buffer());
 }
 
-OP_ERROR SOP_Terrable::cookMySop(OP_Context& context)
+bool SOP_Terrable::writeResult(OP_Context& context, const TerrainSimulation& steppedSimulation, int previewFactor,
+    float yearsSimulated)
 {
-    OP_AutoLockInputs inputs(this);
-    if (inputs.lock(context) >= UT_ERROR_ABORT)
+    if (previewFactor > 1)
     {
-        return error();
+        simulation.addUpsampledChange(previewInitial, steppedSimulation, previewFactor);
     }
 
-    UT_Interrupt* boss = UTgetInterrupt();
-    if (!boss->opStart("running Terrable simulation"))
+    bool writeSucceeded;
     {
-        boss->opEnd();
-        return error();
+        TERRABLE_TRACE_SCOPE("write output");
+        writeSucceeded = writeOutputLayers(previewFactor > 1 ? simulation : steppedSimulation,
+            getIntParam(outputMaskName, context));
     }
 
-    duplicateSource(0, context); // duplicate input geometry
-
-    if (!readInputLayers())
+    if (!writeSucceeded)
     {
-        addWarning(SOP_MESSAGE, "failed reading input layers");
-        boss->opEnd();
-        return error();
+        addWarning(SOP_MESSAGE, "failed writing output layers");
+        return false;
     }
 
-    fpreal now = context.getTime();
-
-    int simTimeYears = getIntParam(simTimeName, context);
-    int seed = getIntParam(seedName, context);
+    GA_RWHandleF yearsSimulatedHandle(gdp->addFloatTuple(GA_ATTRIB_DETAIL, "terrable_years_simulated", 1));
+    yearsSimulatedHandle.set(GA_Offset(0), yearsSimulated);
 
-    SYSsrand48(seed);
-
-    for (int step = 0; step < simTimeYears; ++step)
+    UT_String statsJsonPath = getStringParam(statsJsonName, context);
+    if (SimulationStats::enabled)
     {
-        if (boss->opInterrupt((int)((step * 100.f) / simTimeYears)))
+        writeStatsAttributes(steppedSimulation.getStats());
+
+        if (statsJsonPath.isstring())
         {
-            break;
+            std::ofstream statsJsonFile((const char*)statsJsonPath);
+            statsJsonFile << steppedSimulation.getStats().toJson() << "\n";
+            if (!statsJsonFile)
+            {
+                addWarning(SOP_MESSAGE, "failed writing stats JSON file");
+            }
         }
-
-        stepSimulation(context);
     }
-
-    if (!writeOutputLayers())
+    else if (statsJsonPath.isstring())
     {
-        addWarning(SOP_MESSAGE, "failed writing output layers");
-        boss->opEnd();
-        return error();
+        addWarning(SOP_MESSAGE, "stats JSON requested, but Terrable was built without TERRABLE_ENABLE_STATS");
     }
 
-    boss->opEnd();
-    return error();
+    return true;
 }
@@ -1,23 +1,70 @@
 #pragma once
 
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include <SOP/SOP_Node.h>
+#include <UT/UT_VoxelArray.h>
 
+#include "background_simulation.hpp"
 #include "enums.hpp"
+#include "terrain_simulation.hpp"
 
 namespace Terrable
 {
 
+// thin Houdini wrapper: converts volumes to and from TerrainSimulation's layer planes and runs the simulation
 class SOP_Terrable : public SOP_Node
 {
 private:
-    int width;
-    int height;
-    std::vector<float> terrainLayers;
+    TerrainSimulation simulation;
+
+    // with a preview resolution, the years run on previewSimulation, a downsampled copy of the input, and its change
+    // from previewInitial is upsampled onto the full-resolution layers in simulation for output
+    TerrainSimulation previewInitial;
+    TerrainSimulation previewSimulation;
 
     UT_BoundingBox bbox;
-    float cellSize; // assuming square cells
+
+    // what a simulation was started from; when any of it changes, the simulation starts over. the input counts as
+    // unchanged while its detail is the same one, at the same version
+    struct SimulationSource
+    {
+        exint inputId = -1;
+        exint inputVersion = -1;
+        SimulationParams params;
+        int seed = 0;
+        int previewFactor = 1;
+
+        bool operator==(const SimulationSource& other) const
+        {
+            return inputId == other.inputId && inputVersion == other.inputVersion && params == other.params
+                && seed == other.seed && previewFactor == other.previewFactor;
+        }
+        bool operator!=(const SimulationSource& other) const { return !(*this == other); }
+    };
+
+    // with a cook budget, the simulation carries over between cooks: what it was started from and how many whole years
+    // it has run (the simulation itself keeps a year stopped partway)
+    struct Progress
+    {
+        bool valid = false;
+        SimulationSource source;
+        int yearsDone = 0;
+        int driftFallbackYears = 0;
+    };
+    Progress progress;
+
+    // when simulating in the background, the job runs there and every cook outputs its latest snapshot; the source and
+    // years of the job started last tell whether a cook has to start another
+    std::unique_ptr<BackgroundSimulation> background;
+    SimulationSource backgroundSource;
+    int backgroundYears = -1;
+    // snapshots up to this many have been shown or had a recook requested
+    int recookedSnapshotCount = 0;
+    // whether the UI's event loop polls this node for snapshots, which it does while its job is running
+    bool backgroundWatched = false;
 
 protected:
     SOP_Terrable(OP_Network* net, const char* name, OP_Operator* op);
@@ -28,59 +75,46 @@ public:
 
     static PRM_Template myTemplateList[];
 
+    // callback of the hidden poll_background button, pressed from the UI event loop: recooks the node for every new
+    // snapshot of its background job, on the main thread rather than the job's, and stops the polling once the job
+    // has stopped and its last snapshot is out
+    static int pollBackground(void* data, int index, fpreal time, const PRM_Template* parmTemplate);
+
 protected:
     unsigned disableParms() override;
 
 private:
+    // adds the node to the ones the UI's event loop polls, or takes it out
+    void setBackgroundWatched(bool watched);
+
     int getIntParam(PRM_Name& name, OP_Context& context) { return evalInt(name.getTokenRef(), 0, context.getTime()); }
     float getFloatParam(PRM_Name& name, OP_Context& context) { return evalFloat(name.getTokenRef(), 0, context.getTime()); }
-
-    size_t posToIndex(int x, int y, TerrainLayer layer) const;
-    inline size_t posToIndex(const UT_Vector2i& pos, TerrainLayer layer) const
-    {
-        return posToIndex(pos.x(), pos.y(), layer);
-    }
-
-    float calculateElevation(int x, int y, TerrainLayer topLayer = TerrainLayer::HUMUS) const;
-    inline float calculateElevation(const UT_Vector2i& pos, TerrainLayer topLayer = TerrainLayer::HUMUS) const
+    UT_String getStringParam(PRM_Name& name, OP_Context& context)
     {
-        return calculateElevation(pos.x(), pos.y(), topLayer);
+        UT_String value;
+        evalString(value, name.getTokenRef(), 0, context.getTime());
+        return value;
     }
-    float calculateSlope(int x, int y, TerrainLayer topLayer = TerrainLayer::HUMUS) const;
-    float calculateSlope(const UT_Vector2i& pos1, const UT_Vector2i& pos2, TerrainLayer topLayer = TerrainLayer::HUMUS) const;
-    float calculateCuravature(int x, int y) const;
 
-    void setTerrainSize(int newWidth, int newHeight);
+    // clearLayers = false leaves the terrain cells as they were, for when each layer is read from the input or cleared next
+    void setTerrainSize(int newWidth, int newHeight, bool clearLayers = true);
 
     bool readTerrainLayer(GEO_PrimVolume** volume, const std::string& layerName);
+    void readVoxelsIntoLayers(const std::vector<std::pair<const UT_VoxelArrayF*, TerrainLayer>>& sources);
     bool readInputLayers();
 
     UT_VoxelArrayWriteHandleF createOrReadLayerAndGetWriteHandle(const std::string& layerName, const GEO_PrimVolume* heightPrim);
-    bool writeOutputLayers();
-
-    void stepSimulation(OP_Context& context);
-    void simulateEvent(OP_Context& context, int x, int y, Event event);
+    bool writeOutputLayers(const TerrainSimulation& terrain, int outputMask);
 
-    struct TerrainLayerChange
-    {
-        UT_Vector2i pos;
-        TerrainLayer layer;
-        float change;
-
-        TerrainLayerChange(UT_Vector2i pos, TerrainLayer layer, float change)
-            : pos(pos), layer(layer), change(change)
-        {
-        }
-    };
-    void applyTerrainLayerChanges(const std::vector<TerrainLayerChange>& terrainLayerChanges);
+    // publishes per-event-type stats as detail attributes named terrable_<event>_<stat>
+    void writeStatsAttributes(const SimulationStats& stats);
 
-    bool calculateNextPosFromSlope(const UT_Vector2i& thisPos, UT_Vector2i* nextPos, float* slope, TerrainLayer topLayer = TerrainLayer::HUMUS);
+    OP_ERROR cookSimulation(OP_Context& context);
+    void cookBackground(OP_Context& context, const SimulationSource& source, int simTimeYears);
 
-    void simulateRunoffEvent(OP_Context& context, int x, int y);
-    void simulateTemperatureEvent(OP_Context& context, int x, int y);
-    void simulateLightningEvent(OP_Context& context, int x, int y);
-    void simulateGravityEvent(OP_Context& context, int x, int y);
-    void simulateFireEvent(OP_Context& context, int x, int y);
+    // writes the output volumes, detail attributes and stats of steppedSimulation, which with a preview is the proxy
+    // whose change is added to the input layers first
+    bool writeResult(OP_Context& context, const TerrainSimulation& steppedSimulation, int previewFactor, float yearsSimulated);
 
 protected:
     OP_ERROR cookMySop(OP_Context& context) override;
@@ -0,0 +1,1680 @@
+#include "terrain_simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "numa.hpp"
+#include "simd_kernels.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+using namespace Terrable;
+
+constexpr float layerColorThreshold = 0.05f;
+constexpr float degToRad = 3.14159265358979323846f / 180.f;
+
+TerrainSimulation::TerrainSimulation()
+    : width(0), height(0), stride(0), planeSize(0), neighbourOffsets{}, neighbourDistances{}, cellSize(0.f),
+      lastMassDrift(0.0), ownedRowBegin(0), ownedRowEnd(0), yearEventsDone(0), eventBatchStart(0), eventBatchEnd(0)
+{}
+
+void TerrainSimulation::setParams(const SimulationParams& newParams)
+{
+    const bool boundaryModeChanged = newParams.boundaryMode != params.boundaryMode;
+    params = newParams;
+    if (boundaryModeChanged)
+    {
+        updateGhostCells();
+    }
+}
+
+namespace
+{
+
+// calls func with std::integral_constant<TerrainLayer, topLayer>, turning a runtime layer into a template argument
+template <typename Func>
+decltype(auto) dispatchTopLayer(TerrainLayer topLayer, Func&& func)
+{
+    switch (topLayer)
+    {
+    case TerrainLayer::BEDROCK:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::BEDROCK>());
+    case TerrainLayer::ROCK:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::ROCK>());
+    case TerrainLayer::SAND:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::SAND>());
+    case TerrainLayer::HUMUS:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::HUMUS>());
+    case TerrainLayer::MOISTURE:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::MOISTURE>());
+    case TerrainLayer::VEGETATION:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::VEGETATION>());
+    default:
+        return func(std::integral_constant<TerrainLayer, TerrainLayer::DEAD_VEGETATION>());
+    }
+}
+
+// compare-and-swap loop on the value's bits, since C++17 has no atomic floating-point add on plain memory
+void atomicAdd(float* target, float delta)
+{
+    static_assert(sizeof(float) == sizeof(uint32_t), "float must be 32 bits");
+#ifdef _MSC_VER
+    volatile long* targetBits = reinterpret_cast<volatile long*>(target);
+    long expectedBits = *targetBits;
+    while (true)
+    {
+        float expected;
+        std::memcpy(&expected, &expectedBits, sizeof(float));
+        const float desired = expected + delta;
+        long desiredBits;
+        std::memcpy(&desiredBits, &desired, sizeof(float));
+        const long previousBits = _InterlockedCompareExchange(targetBits, desiredBits, expectedBits);
+        if (previousBits == expectedBits)
+        {
+            return;
+        }
+        expectedBits = previousBits;
+    }
+#else
+    uint32_t* targetBits = reinterpret_cast<uint32_t*>(target);
+    uint32_t expectedBits = __atomic_load_n(targetBits, __ATOMIC_RELAXED);
+    while (true)
+    {
+        float expected;
+        std::memcpy(&expected, &expectedBits, sizeof(float));
+        const float desired = expected + delta;
+        uint32_t desiredBits;
+        std::memcpy(&desiredBits, &desired, sizeof(float));
+        if (__atomic_compare_exchange_n(targetBits, &expectedBits, desiredBits, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            return;
+        }
+    }
+#endif
+}
+
+} // namespace
+
+float TerrainSimulation::calculateElevation(int x, int y, TerrainLayer topLayer) const
+{
+    return dispatchTopLayer(topLayer, [&](auto layer) { return calculateElevation<decltype(layer)::value>(x, y); });
+}
+
+template <TerrainLayer topLayer>
+float TerrainSimulation::calculateSlope(int x, int y) const
+{
+    // neighbours across the edge come from the ghost border
+    const size_t cellIdx = posToIndex(x, y, TerrainLayer::BEDROCK);
+    float hLeft = calculateElevationAt<topLayer>(getNeighbourIndex(cellIdx, 2));
+    float hRight = calculateElevationAt<topLayer>(getNeighbourIndex(cellIdx, 0));
+    float hDown = calculateElevationAt<topLayer>(getNeighbourIndex(cellIdx, 3));
+    float hUp = calculateElevationAt<topLayer>(getNeighbourIndex(cellIdx, 1));
+
+    float slopeX = (hRight - hLeft) / (2.f * cellSize);
+    float slopeY = (hUp - hDown) / (2.f * cellSize);
+
+    return sqrt(slopeX * slopeX + slopeY * slopeY);
+}
+
+float TerrainSimulation::calculateSlope(int x, int y, TerrainLayer topLayer) const
+{
+    return dispatchTopLayer(topLayer, [&](auto layer) { return calculateSlope<decltype(layer)::value>(x, y); });
+}
+
+template <TerrainLayer topLayer>
+float TerrainSimulation::calculateSlope(const Vec2i& pos1, const Vec2i& pos2) const
+{
+    float h1 = calculateElevation<topLayer>(pos1);
+    float h2 = calculateElevation<topLayer>(pos2);
+
+    float dx = pos2.x - pos1.x;
+    float dy = pos2.y - pos1.y;
+    float d = sqrtf(dx * dx + dy * dy) * cellSize;
+
+    return (h2 - h1) / d;
+}
+
+float TerrainSimulation::calculateSlope(const Vec2i& pos1, const Vec2i& pos2, TerrainLayer topLayer) const
+{
+    return dispatchTopLayer(topLayer, [&](auto layer) { return calculateSlope<decltype(layer)::value>(pos1, pos2); });
+}
+
+float TerrainSimulation::calculateCuravature(int x, int y) const
+{
+    return calculateSlope<TerrainLayer::HUMUS>(x, y); // TODO: pretty sure curvature calculation is more complicated than this
+}
+
+int TerrainSimulation::calculateTopVisibleLayer(int x, int y) const
+{
+    for (int terrainLayerIdx = (int)TerrainLayer::HUMUS; terrainLayerIdx > (int)TerrainLayer::BEDROCK; --terrainLayerIdx)
+    {
+        if (terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)] > layerColorThreshold)
+        {
+            return terrainLayerIdx;
+        }
+    }
+    return (int)TerrainLayer::BEDROCK;
+}
+
+void TerrainSimulation::setTerrainSize(int newWidth, int newHeight, float newCellSize, ThreadPool* pool,
+    MemoryPlacement placement, bool clearLayers)
+{
+    width = newWidth;
+    height = newHeight;
+    cellSize = newCellSize;
+    ownedRowBegin = 0;
+    ownedRowEnd = height;
+    yearEventsDone = 0;
+#ifdef TERRABLE_TILED_LAYOUT
+    const size_t tilesX = ((size_t)width + 2 + tileSize - 1) >> tileShift;
+    const size_t tilesY = ((size_t)height + 2 + tileSize - 1) >> tileShift;
+    stride = tilesX * tileCells;
+    planeSize = stride * tilesY;
+#else
+    // planes are padded to whole cache lines, so each one starts as aligned as the buffer
+    constexpr size_t alignmentFloats = layerAlignment / sizeof(float);
+    stride = (size_t)width + 2;
+    planeSize = (stride * (height + 2) + alignmentFloats - 1) / alignmentFloats * alignmentFloats;
+#endif
+    for (size_t directionIdx = 0; directionIdx < neighbourDirections.size(); ++directionIdx)
+    {
+        const Vec2i& direction = neighbourDirections[directionIdx];
+        neighbourOffsets[directionIdx] = direction.x + direction.y * (ptrdiff_t)stride;
+        neighbourDistances[directionIdx] = direction.x != 0 && direction.y != 0 ? cellSize * sqrtf(2.f) : cellSize;
+    }
+
+    // a buffer of the right size is kept, pages and all, so recooking at the same resolution doesn't reallocate
+    const size_t numValues = (size_t)numTerrainLayers * planeSize;
+    const bool reused = terrainLayers.size() == numValues;
+    if (!reused)
+    {
+        // fresh storage, so the pages are placed below rather than reused from the previous size
+        terrainLayers = std::vector<float, LayerAllocator<float>>();
+        terrainLayers.resize(numValues);
+    }
+
+    // every plane is split the same way into one band of padded rows (or tile rows) per node, so each node holds an even
+    // share of the terrain with all layers of a cell together, and threads on every node pull on all memory controllers
+    // rather than one. where pages can't be bound, the threads that fill them first decide where they go instead
+    const int numNodes = getNumaNodeCount();
+    if (!reused && placement == MemoryPlacement::SPREAD && numNodes > 1)
+    {
+        const size_t numRows = planeSize / stride;
+        for (int layerIdx = 0; layerIdx < numTerrainLayers; ++layerIdx)
+        {
+            for (int node = 0; node < numNodes; ++node)
+            {
+                const size_t rowBegin = numRows * node / numNodes;
+                const size_t rowEnd = numRows * (node + 1) / numNodes;
+                bindToNumaNode(terrainLayers.data() + layerIdx * planeSize + rowBegin * stride,
+                    (rowEnd - rowBegin) * stride * sizeof(float), node);
+            }
+        }
+    }
+
+    // a caller about to overwrite every cell can skip this; fresh pages are then first touched by its writes, and only
+    // what it won't write is zeroed, so a reused buffer doesn't carry stale values in its border or padding
+    if (!clearLayers)
+    {
+        clearPadding();
+        return;
+    }
+
+    if (placement == MemoryPlacement::LOCAL)
+    {
+        std::fill(terrainLayers.begin(), terrainLayers.end(), 0.f);
+        return;
+    }
+
+    constexpr int fillBlockSize = 1 << 16;
+    const int numBlocks = (int)((numValues + fillBlockSize - 1) / fillBlockSize);
+    (pool ? *pool : ThreadPool::getShared()).parallelFor(0, numBlocks, 1, [&](int blockBegin, int blockEnd)
+    {
+        std::fill(terrainLayers.begin() + (size_t)blockBegin * fillBlockSize,
+            terrainLayers.begin() + std::min((size_t)blockEnd * fillBlockSize, numValues), 0.f);
+    });
+}
+
+void TerrainSimulation::clearLayer(TerrainLayer layer, ThreadPool* pool)
+{
+    constexpr int fillBlockSize = 1 << 16;
+    const size_t planeBegin = (size_t)layer * planeSize;
+    const int numBlocks = (int)((planeSize + fillBlockSize - 1) / fillBlockSize);
+    (pool ? *pool : ThreadPool::getShared()).parallelFor(0, numBlocks, 1, [&](int blockBegin, int blockEnd)
+    {
+        std::fill(terrainLayers.begin() + planeBegin + (size_t)blockBegin * fillBlockSize,
+            terrainLayers.begin() + planeBegin + std::min((size_t)blockEnd * fillBlockSize, planeSize), 0.f);
+    });
+}
+
+void TerrainSimulation::clearPadding()
+{
+    // padded coordinates run from -1 up to the last cell the plane has room for, which is only ghost border in the
+    // row-major layout but includes part of a tile beyond it in the tiled one
+#ifdef TERRABLE_TILED_LAYOUT
+    const int paddedWidth = (int)(stride >> (2 * tileShift)) << tileShift;
+    const int paddedHeight = (int)(planeSize / stride) << tileShift;
+#else
+    const int paddedWidth = (int)stride;
+    const int paddedHeight = height + 2;
+#endif
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+    {
+        const TerrainLayer layer = (TerrainLayer)terrainLayerIdx;
+        for (int y = -1; y < paddedHeight - 1; ++y)
+        {
+            // rows of terrain only have padding left of the first cell and right of the last
+            const bool terrainRow = y >= 0 && y < height;
+            terrainLayers[posToIndex(-1, y, layer)] = 0.f;
+            for (int x = terrainRow ? width : 0; x < paddedWidth - 1; ++x)
+            {
+                terrainLayers[posToIndex(x, y, layer)] = 0.f;
+            }
+        }
+
+#ifndef TERRABLE_TILED_LAYOUT
+        // planes are rounded up to whole cache lines past the last ghost row
+        std::fill(terrainLayers.begin() + posToIndex(width, height, layer) + 1,
+            terrainLayers.begin() + (size_t)(terrainLayerIdx + 1) * planeSize, 0.f);
+#endif
+    }
+}
+
+// clamp copies the edge, wrap the opposite edge, and open extrapolates the edge slope outward
+float TerrainSimulation::getGhostValue(float edgeValue, float innerValue, float oppositeValue) const
+{
+    switch (params.boundaryMode)
+    {
+    case BoundaryMode::WRAP:
+        return oppositeValue;
+    case BoundaryMode::OPEN:
+        return 2.f * edgeValue - innerValue;
+    default:
+        return edgeValue;
+    }
+}
+
+void TerrainSimulation::updateGhostRow(TerrainLayer layer, int y)
+{
+    const int inner = std::min(1, width - 1);
+    const float first = terrainLayers[posToIndex(0, y, layer)];
+    const float last = terrainLayers[posToIndex(width - 1, y, layer)];
+    terrainLayers[posToIndex(-1, y, layer)] = getGhostValue(first, terrainLayers[posToIndex(inner, y, layer)], last);
+    terrainLayers[posToIndex(width, y, layer)] =
+        getGhostValue(last, terrainLayers[posToIndex(width - 1 - inner, y, layer)], first);
+}
+
+// also covers the corners when x is -1 or width, provided the ghost rows next to them are up to date
+void TerrainSimulation::updateGhostColumn(TerrainLayer layer, int x)
+{
+    const int inner = std::min(1, height - 1);
+    const float first = terrainLayers[posToIndex(x, 0, layer)];
+    const float last = terrainLayers[posToIndex(x, height - 1, layer)];
+    terrainLayers[posToIndex(x, -1, layer)] = getGhostValue(first, terrainLayers[posToIndex(x, inner, layer)], last);
+    terrainLayers[posToIndex(x, height, layer)] =
+        getGhostValue(last, terrainLayers[posToIndex(x, height - 1 - inner, layer)], first);
+}
+
+#ifdef TERRABLE_TILED_LAYOUT
+// calls func(x - x0, cellIdx) along a row one tile at a time; within a tile only the x bits of the Morton code change,
+// so they come from a table instead of being re-encoded, and the indices of consecutive cells don't depend on each other
+template <typename Func>
+void TerrainSimulation::forEachTiledRowCell(TerrainLayer layer, int x0, int y, int count, Func&& func) const
+{
+    static constexpr auto mortonX = []
+    {
+        std::array<size_t, tileSize> table{};
+        for (int x = 0; x < tileSize; ++x)
+        {
+            table[x] = spreadMortonBits(x);
+        }
+        return table;
+    }();
+
+    int x = 0;
+    while (x < count)
+    {
+        const int paddedX = x0 + x + 1;
+        const int inTileX = paddedX & (tileSize - 1);
+        const int runLength = std::min(tileSize - inTileX, count - x);
+        const size_t tileRowIdx = posToIndex(x0 + x, y, layer) - mortonX[inTileX];
+        for (int runIdx = 0; runIdx < runLength; ++runIdx)
+        {
+            func(x + runIdx, tileRowIdx + mortonX[inTileX + runIdx]);
+        }
+        x += runLength;
+    }
+}
+#endif
+
+void TerrainSimulation::readLayerRow(TerrainLayer layer, int x0, int y, int count, float* out) const
+{
+#ifdef TERRABLE_TILED_LAYOUT
+    forEachTiledRowCell(layer, x0, y, count, [&](int x, size_t cellIdx) { out[x] = terrainLayers[cellIdx]; });
+#else
+    std::copy_n(&terrainLayers[posToIndex(x0, y, layer)], count, out);
+#endif
+}
+
+void TerrainSimulation::writeLayerRow(TerrainLayer layer, int x0, int y, int count, const float* in)
+{
+#ifdef TERRABLE_TILED_LAYOUT
+    forEachTiledRowCell(layer, x0, y, count, [&](int x, size_t cellIdx) { terrainLayers[cellIdx] = in[x]; });
+#else
+    std::copy_n(in, count, &terrainLayers[posToIndex(x0, y, layer)]);
+#endif
+}
+
+void TerrainSimulation::updateGhostCells()
+{
+    if (width == 0 || height == 0)
+    {
+        return;
+    }
+
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+    {
+        const TerrainLayer layer = (TerrainLayer)terrainLayerIdx;
+        for (int y = 0; y < height; ++y)
+        {
+            updateGhostRow(layer, y);
+        }
+        for (int x = -1; x <= width; ++x)
+        {
+            updateGhostColumn(layer, x);
+        }
+    }
+}
+
+bool TerrainSimulation::foldGhostPos(Vec2i* pos) const
+{
+    switch (params.boundaryMode)
+    {
+    case BoundaryMode::WRAP:
+        pos->x = pos->x < 0 ? pos->x + width : pos->x >= width ? pos->x - width : pos->x;
+        pos->y = pos->y < 0 ? pos->y + height : pos->y >= height ? pos->y - height : pos->y;
+        return true;
+    case BoundaryMode::OPEN:
+        return false;
+    default:
+        pos->x = std::clamp(pos->x, 0, width - 1);
+        pos->y = std::clamp(pos->y, 0, height - 1);
+        return true;
+    }
+}
+
+void TerrainSimulation::initializeHumusFromBedrock(ThreadPool& pool)
+{
+    TERRABLE_TRACE_SCOPE("initialize humus");
+
+    // slope comes from bedrock alone (including its ghost border), so rows can be written in any order without reading
+    // humus that is being replaced
+    updateGhostCells();
+
+    const SimdKernels& kernels = getSimdKernels();
+
+#ifdef TERRABLE_TILED_LAYOUT
+    // the kernels work on rows, so bedrock is copied out into a sliding window of rows y - 1 to y + 1 (ghosts included)
+    const int paddedWidth = width + 2;
+    pool.parallelFor(0, height, 16, [&](int rowBegin, int rowEnd)
+    {
+        std::vector<float> bedrockRows((size_t)3 * paddedWidth);
+        std::vector<float> humusRow(width);
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            if (y == rowBegin)
+            {
+                readLayerRow(TerrainLayer::BEDROCK, -1, y - 1, paddedWidth, &bedrockRows[0]);
+                readLayerRow(TerrainLayer::BEDROCK, -1, y, paddedWidth, &bedrockRows[paddedWidth]);
+            }
+            else // shift the window up one row so only the new bottom row is read
+            {
+                std::copy(bedrockRows.begin() + paddedWidth, bedrockRows.end(), bedrockRows.begin());
+            }
+            readLayerRow(TerrainLayer::BEDROCK, -1, y + 1, paddedWidth, &bedrockRows[(size_t)2 * paddedWidth]);
+            kernels.computeHumusRow(&bedrockRows[paddedWidth + 1], paddedWidth, width, cellSize, humusRow.data());
+            writeLayerRow(TerrainLayer::HUMUS, 0, y, width, humusRow.data());
+        }
+    });
+#else
+    const float* bedrock = &terrainLayers[posToIndex(0, 0, TerrainLayer::BEDROCK)];
+    float* humus = &terrainLayers[posToIndex(0, 0, TerrainLayer::HUMUS)];
+
+    pool.parallelFor(0, height, 16, [&](int rowBegin, int rowEnd)
+    {
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            kernels.computeHumusRow(bedrock + y * stride, stride, width, cellSize, humus + y * stride);
+        }
+    });
+#endif
+
+    updateGhostCells();
+}
+
+void TerrainSimulation::writeSurface(ThreadPool& pool, float* heightOut, const std::array<float*, 3>& colorOut) const
+{
+    TERRABLE_TRACE_SCOPE("write surface");
+
+    pool.parallelFor(0, height, 16, [&](int rowBegin, int rowEnd)
+    {
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            const size_t rowOffset = (size_t)y * width;
+            std::array<float*, 3> colorRow{};
+            if (colorOut[0])
+            {
+                colorRow = { colorOut[0] + rowOffset, colorOut[1] + rowOffset, colorOut[2] + rowOffset };
+            }
+            writeSurfaceRow(0, y, width, heightOut ? heightOut + rowOffset : nullptr, colorRow);
+        }
+    });
+}
+
+void TerrainSimulation::writeSurfaceRow(int x0, int y, int count, float* heightOut, const std::array<float*, 3>& colorOut) const
+{
+    // height sums bedrock up to humus; color picks the topmost of rock, sand, humus above the threshold, else bedrock
+    static constexpr int numSurfaceLayers = (int)TerrainLayer::HUMUS + 1;
+    struct SurfaceColors
+    {
+        float rgb[numSurfaceLayers][3];
+    };
+    static const SurfaceColors colors = []
+    {
+        SurfaceColors table;
+        for (int terrainLayerIdx = 0; terrainLayerIdx < numSurfaceLayers; ++terrainLayerIdx)
+        {
+            std::copy_n(terrainLayerColors[terrainLayerIdx].begin(), 3, table.rgb[terrainLayerIdx]);
+        }
+        return table;
+    }();
+
+    const SimdKernels& kernels = getSimdKernels();
+    const float* planes[numSurfaceLayers];
+#ifdef TERRABLE_TILED_LAYOUT
+    // gather the row of each plane so the kernels can stream them
+    thread_local std::vector<float> planeRows;
+    planeRows.resize((size_t)numSurfaceLayers * count);
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numSurfaceLayers; ++terrainLayerIdx)
+    {
+        float* planeRow = &planeRows[(size_t)terrainLayerIdx * count];
+        readLayerRow((TerrainLayer)terrainLayerIdx, x0, y, count, planeRow);
+        planes[terrainLayerIdx] = planeRow;
+    }
+    const size_t offset = 0;
+#else
+    for (int terrainLayerIdx = 0; terrainLayerIdx < numSurfaceLayers; ++terrainLayerIdx)
+    {
+        planes[terrainLayerIdx] = &terrainLayers[posToIndex(0, 0, (TerrainLayer)terrainLayerIdx)];
+    }
+    const size_t offset = y * stride + x0;
+#endif
+
+    if (heightOut)
+    {
+        kernels.sumPlanesRow(planes, numSurfaceLayers, offset, count, heightOut);
+    }
+
+    if (colorOut[0])
+    {
+        kernels.selectColorRow(planes + 1, numSurfaceLayers - 1, offset, count,
+            colors.rgb, layerColorThreshold, colorOut.data());
+    }
+}
+
+void TerrainSimulation::copyLayersFrom(const TerrainSimulation& source, ThreadPool* pool)
+{
+    TERRABLE_TRACE_SCOPE("copy layers");
+
+    // the same size gives the same layout, so the planes, ghost cells included, copy over as they are
+    ThreadPool& threadPool = pool ? *pool : ThreadPool::getShared();
+    params = source.params;
+    setTerrainSize(source.width, source.height, source.cellSize, &threadPool, MemoryPlacement::SPREAD, false);
+    ownedRowBegin = source.ownedRowBegin;
+    ownedRowEnd = source.ownedRowEnd;
+    serialWorker.stats = source.serialWorker.stats;
+
+    constexpr int copyBlockSize = 1 << 16;
+    const size_t numValues = terrainLayers.size();
+    const int numBlocks = (int)((numValues + copyBlockSize - 1) / copyBlockSize);
+    threadPool.parallelFor(0, numBlocks, 1, [&](int blockBegin, int blockEnd)
+    {
+        std::copy(source.terrainLayers.begin() + (size_t)blockBegin * copyBlockSize,
+            source.terrainLayers.begin() + std::min((size_t)blockEnd * copyBlockSize, numValues),
+            terrainLayers.begin() + (size_t)blockBegin * copyBlockSize);
+    });
+}
+
+void TerrainSimulation::downsampleFrom(const TerrainSimulation& source, int factor, ThreadPool* pool)
+{
+    TERRABLE_TRACE_SCOPE("downsample layers");
+
+    // ghost cells are refilled below, so the params can be taken over without setParams refreshing them first
+    ThreadPool& threadPool = pool ? *pool : ThreadPool::getShared();
+    params = source.params;
+    setTerrainSize((source.width + factor - 1) / factor, (source.height + factor - 1) / factor, source.cellSize * factor,
+        &threadPool, MemoryPlacement::SPREAD, false);
+
+    // proxy cells on the right and bottom edge cover fewer source cells when factor doesn't divide the size
+    threadPool.parallelFor(0, height, 4, [&](int rowBegin, int rowEnd)
+    {
+        std::vector<float> sourceRow(source.width);
+        std::vector<float> sums(width);
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            const int sourceY0 = y * factor;
+            const int sourceY1 = std::min(sourceY0 + factor, source.height);
+            for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+            {
+                const TerrainLayer layer = (TerrainLayer)terrainLayerIdx;
+                std::fill(sums.begin(), sums.end(), 0.f);
+                for (int sourceY = sourceY0; sourceY < sourceY1; ++sourceY)
+                {
+                    source.readLayerRow(layer, 0, sourceY, source.width, sourceRow.data());
+                    for (int sourceX = 0; sourceX < source.width; ++sourceX)
+                    {
+                        sums[sourceX / factor] += sourceRow[sourceX];
+                    }
+                }
+
+                for (int x = 0; x < width; ++x)
+                {
+                    const int numCovered = (std::min((x + 1) * factor, source.width) - x * factor) * (sourceY1 - sourceY0);
+                    sums[x] /= (float)numCovered;
+                }
+                writeLayerRow(layer, 0, y, width, sums.data());
+            }
+        }
+    });
+
+    updateGhostCells();
+}
+
+void TerrainSimulation::addUpsampledChange(const TerrainSimulation& initial, const TerrainSimulation& proxy, int factor,
+    ThreadPool* pool)
+{
+    TERRABLE_TRACE_SCOPE("upsample layer changes");
+
+    // proxy cell i is centred on cell (i + 0.5) * factor - 0.5 here; past the outermost centres the change stays constant
+    auto findProxyCells = [factor](int idx, int proxySize, int* proxyIdx0, int* proxyIdx1, float* weight)
+    {
+        const float proxyPos = std::clamp((idx + 0.5f) / factor - 0.5f, 0.f, (float)(proxySize - 1));
+        *proxyIdx0 = (int)proxyPos;
+        *proxyIdx1 = std::min(*proxyIdx0 + 1, proxySize - 1);
+        *weight = proxyPos - *proxyIdx0;
+    };
+
+    std::vector<int> proxyX0s(width);
+    std::vector<int> proxyX1s(width);
+    std::vector<float> weightsX(width);
+    for (int x = 0; x < width; ++x)
+    {
+        findProxyCells(x, proxy.width, &proxyX0s[x], &proxyX1s[x], &weightsX[x]);
+    }
+
+    (pool ? *pool : ThreadPool::getShared()).parallelFor(0, height, 4, [&](int rowBegin, int rowEnd)
+    {
+        std::vector<float> initialRow(proxy.width);
+        std::vector<float> proxyRow(proxy.width);
+        std::vector<float> changeRow0(proxy.width);
+        std::vector<float> changeRow1(proxy.width);
+        std::vector<float> row(width);
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            int proxyY0;
+            int proxyY1;
+            float weightY;
+            findProxyCells(y, proxy.height, &proxyY0, &proxyY1, &weightY);
+
+            for (int terrainLayerIdx = 0; terrainLayerIdx < numTerrainLayers; ++terrainLayerIdx)
+            {
+                const TerrainLayer layer = (TerrainLayer)terrainLayerIdx;
+
+                // interpolate between the two proxy rows first, then along the row
+                for (int proxyRowIdx = 0; proxyRowIdx < 2; ++proxyRowIdx)
+                {
+                    const int proxyY = proxyRowIdx == 0 ? proxyY0 : proxyY1;
+                    std::vector<float>& changeRow = proxyRowIdx == 0 ? changeRow0 : changeRow1;
+                    initial.readLayerRow(layer, 0, proxyY, proxy.width, initialRow.data());
+                    proxy.readLayerRow(layer, 0, proxyY, proxy.width, proxyRow.data());
+                    for (int proxyX = 0; proxyX < proxy.width; ++proxyX)
+                    {
+                        changeRow[proxyX] = proxyRow[proxyX] - initialRow[proxyX];
+                    }
+                }
+                for (int proxyX = 0; proxyX < proxy.width; ++proxyX)
+                {
+                    changeRow0[proxyX] += (changeRow1[proxyX] - changeRow0[proxyX]) * weightY;
+                }
+
+                readLayerRow(layer, 0, y, width, row.data());
+                for (int x = 0; x < width; ++x)
+                {
+                    const float change0 = changeRow0[proxyX0s[x]];
+                    row[x] += change0 + (changeRow0[proxyX1s[x]] - change0) * weightsX[x];
+                    if (layer != TerrainLayer::BEDROCK)
+                    {
+                        row[x] = std::max(row[x], 0.f);
+                    }
+                }
+                writeLayerRow(layer, 0, y, width, row.data());
+            }
+        }
+    });
+
+    updateGhostCells();
+}
+
+void TerrainSimulation::setOwnedRows(int rowBegin, int rowEnd)
+{
+    ownedRowBegin = rowBegin;
+    ownedRowEnd = rowEnd;
+    yearEventsDone = 0;
+}
+
+std::vector<WalkState> TerrainSimulation::takeHandedOffWalks()
+{
+    std::vector<WalkState> walks = std::move(serialWorker.handedOffWalks);
+    serialWorker.handedOffWalks.clear();
+    for (auto& worker : parallelWorkers)
+    {
+        walks.insert(walks.end(), worker.handedOffWalks.begin(), worker.handedOffWalks.end());
+        worker.handedOffWalks.clear();
+    }
+    return walks;
+}
+
+void TerrainSimulation::continueWalk(const WalkState& walk)
+{
+    if (walk.event == Event::RUNOFF)
+    {
+        runRunoffWalk(serialWorker, walk, false);
+    }
+    else
+    {
+        runGravityWalk(serialWorker, walk);
+    }
+}
+
+void TerrainSimulation::depositWalk(const WalkState& walk)
+{
+    std::vector<TerrainLayerChange> terrainLayerChanges;
+    terrainLayerChanges.emplace_back(walk.pos, TerrainLayer::ROCK, walk.carried[0]);
+    terrainLayerChanges.emplace_back(walk.pos, TerrainLayer::SAND, walk.carried[1]);
+    terrainLayerChanges.emplace_back(walk.pos, TerrainLayer::HUMUS, walk.carried[2]);
+    applyTerrainLayerChanges(serialWorker, terrainLayerChanges);
+}
+
+bool TerrainSimulation::stepSimulation(const ProgressCallback& progressCallback, ThreadPool* pool)
+{
+    // layers may have been written through writeLayerRow since the last year
+    updateGhostCells();
+
+    if (yearEventsDone == 0)
+    {
+        lastMassDrift = 0.0;
+        eventBatchEnd = 0;
+    }
+
+    int numSimulated = yearEventsDone;
+    bool completed = true;
+    if (params.executionMode == ExecutionMode::DEFERRED)
+    {
+        completed = simulateDeferredEvents(pool ? *pool : ThreadPool::getShared(), numSimulated, progressCallback, &numSimulated);
+    }
+    else
+    {
+        if (params.executionMode == ExecutionMode::HOGWILD)
+        {
+            completed = simulateHogwildEvents(pool ? *pool : ThreadPool::getShared(), numSimulated, progressCallback, &numSimulated);
+        }
+        if (completed)
+        {
+            completed = simulateSerialEvents(numSimulated, progressCallback, &numSimulated);
+        }
+    }
+
+    yearEventsDone = completed ? 0 : numSimulated;
+    return completed;
+}
+
+bool TerrainSimulation::simulateSerialEvents(int firstEventIdx, const ProgressCallback& progressCallback, int* numSimulated)
+{
+    // while tracing, time spent per event kind is summed and emitted as one counter sample per year
+    const bool traceEventKinds = Tracer::isEnabled();
+    std::array<double, numEvents> eventKindSeconds{};
+
+    // the callback is only checked once per progressCheckInterval events. batched events are drawn eventBatchSize at a
+    // time; each batch is the same independent uniform draws as in random order, just run grouped by type and tile. a
+    // year continued partway through a batch picks up in the batch drawn before
+    const int numEventsToSimulate = getNumOwnedCells() * numEvents;
+    const bool batched = params.eventOrder == EventOrder::BATCHED;
+    bool completed = true;
+    int i = firstEventIdx;
+    while (i < numEventsToSimulate && completed)
+    {
+        int blockEnd = std::min(i + progressCheckInterval, numEventsToSimulate);
+        if (batched)
+        {
+            if (i < eventBatchStart || i >= eventBatchEnd)
+            {
+                eventBatchStart = i;
+                eventBatchEnd = std::min(i + eventBatchSize, numEventsToSimulate);
+                drawEventBatch(eventBatchEnd - eventBatchStart);
+            }
+            blockEnd = eventBatchEnd;
+        }
+
+        for (; i < blockEnd; ++i)
+        {
+            int x;
+            int y;
+            Event event;
+            if (batched)
+            {
+                const uint64_t key = eventBatchKeys[i - eventBatchStart];
+                const Vec2i& pos = eventBatchPositions[key & (eventBatchSize - 1)];
+                x = pos.x;
+                y = pos.y;
+                event = (Event)(key >> 61);
+            }
+            else
+            {
+                drawEvent(serialWorker, &x, &y, &event);
+            }
+
+            if (traceEventKinds)
+            {
+                const auto eventStart = Tracer::Clock::now();
+                simulateEvent(serialWorker, x, y, event);
+                eventKindSeconds[(int)event] += std::chrono::duration<double>(Tracer::Clock::now() - eventStart).count();
+            }
+            else
+            {
+                simulateEvent(serialWorker, x, y, event);
+            }
+
+            // an interrupted batch has run its earlier event types only, which a partial year may reflect
+            const int numDone = i + 1;
+            if (numDone % progressCheckInterval == 0 && numDone < numEventsToSimulate && progressCallback
+                && !progressCallback((float)numDone / numEventsToSimulate))
+            {
+                completed = false;
+                ++i;
+                break;
+            }
+        }
+    }
+
+    if (traceEventKinds)
+    {
+        Tracer::recordCounter("event kind seconds", eventNames, eventKindSeconds);
+    }
+
+    *numSimulated = i;
+    return completed;
+}
+
+// every worker runs its share of each round straight on the shared layers, reading whatever other workers have
+// written so far. updates are atomic adds, so none are lost, but a walk can act on values that change under it, e.g.
+// two walks eroding the same sediment. the reads are deliberately unsynchronized (benign on the x86-64 and ARM64
+// targets, where aligned float loads never tear). ghost refreshes can race with edge changes, so all ghost cells are
+// refreshed again between rounds. once per numCells events, negative sediment is clamped and the drift from the
+// expected mass is checked against params.maxMassDrift
+bool TerrainSimulation::simulateHogwildEvents(ThreadPool& pool, int firstEventIdx, const ProgressCallback& progressCallback,
+    int* numSimulated)
+{
+    TERRABLE_TRACE_SCOPE("hogwild events");
+
+    const int numWorkers = pool.getNumThreads();
+    resetParallelWorkers(numWorkers, ChangeMode::ATOMIC);
+
+    const int numEventsToSimulate = getNumOwnedCells() * numEvents;
+    const int roundSize = numWorkers * progressCheckInterval;
+    const double initialMass = sumMass(pool, false);
+    int nextMassCheck = firstEventIdx + getNumOwnedCells();
+    bool completed = true;
+
+    int roundStart = firstEventIdx;
+    while (roundStart < numEventsToSimulate)
+    {
+        // worker w takes events roundStart + w, roundStart + w + numWorkers, ...
+        const int roundEnd = std::min(roundStart + roundSize, numEventsToSimulate);
+        pool.parallelFor(0, numWorkers, 1, [&](int workerBegin, int workerEnd)
+        {
+            for (int workerIdx = workerBegin; workerIdx < workerEnd; ++workerIdx)
+            {
+                EventWorker& worker = parallelWorkers[workerIdx];
+                for (int i = roundStart + workerIdx; i < roundEnd; i += numWorkers)
+                {
+                    int x;
+                    int y;
+                    Event event;
+                    drawEvent(worker, &x, &y, &event);
+                    simulateEvent(worker, x, y, event);
+                }
+            }
+        });
+        roundStart = roundEnd;
+
+        bool driftExceeded = false;
+        if (roundStart >= nextMassCheck || roundStart == numEventsToSimulate)
+        {
+            double expectedMass = initialMass;
+            for (const auto& worker : parallelWorkers)
+            {
+                expectedMass += worker.massChange;
+            }
+            const double mass = sumMass(pool, true);
+            lastMassDrift = fabs(mass - expectedMass) / std::max(fabs(initialMass), 1e-6);
+            driftExceeded = lastMassDrift > params.maxMassDrift;
+            nextMassCheck += getNumOwnedCells();
+        }
+
+        updateGhostCells();
+        if (driftExceeded)
+        {
+            break;
+        }
+
+        if (progressCallback && roundStart < numEventsToSimulate && !progressCallback((float)roundStart / numEventsToSimulate))
+        {
+            completed = false;
+            break;
+        }
+    }
+
+    for (auto& worker : parallelWorkers)
+    {
+        serialWorker.stats.merge(worker.stats);
+        worker.stats.reset();
+    }
+
+    *numSimulated = roundStart;
+    return completed;
+}
+
+// every worker runs its share of a batch reading the layers as they were when the batch started, since nothing is
+// written to them until the batch is merged. a walk therefore doesn't see the other events of its batch, much as a
+// serial walk doesn't see its own earlier steps. workers draw from their own random sequences, seeded from the serial
+// one, and the merge adds changes in worker order, so a seed and thread count fix the result
+bool TerrainSimulation::simulateDeferredEvents(ThreadPool& pool, int firstEventIdx, const ProgressCallback& progressCallback,
+    int* numSimulated)
+{
+    TERRABLE_TRACE_SCOPE("deferred events");
+
+    // a continued year keeps the workers' random sequences, so it ends up as if it had run in one go
+    const int numWorkers = pool.getNumThreads();
+    if (firstEventIdx == 0 || (int)parallelWorkers.size() != numWorkers
+        || parallelWorkers.front().changeMode != ChangeMode::DEFERRED)
+    {
+        resetParallelWorkers(numWorkers, ChangeMode::DEFERRED);
+    }
+
+    const int numEventsToSimulate = getNumOwnedCells() * numEvents;
+    const int batchSize = numWorkers * deferredWorkerBatchSize;
+    int nextProgressCheck = firstEventIdx + progressCheckInterval;
+    bool completed = true;
+    int batchStart = firstEventIdx;
+    while (batchStart < numEventsToSimulate)
+    {
+        // worker w takes events batchStart + w, batchStart + w + numWorkers, ...
+        const int batchEnd = std::min(batchStart + batchSize, numEventsToSimulate);
+        pool.parallelFor(0, numWorkers, 1, [&](int workerBegin, int workerEnd)
+        {
+            for (int workerIdx = workerBegin; workerIdx < workerEnd; ++workerIdx)
+            {
+                EventWorker& worker = parallelWorkers[workerIdx];
+                worker.deferredChanges.clear();
+                worker.edgeChanges.clear();
+                for (int i = batchStart + workerIdx; i < batchEnd; i += numWorkers)
+                {
+                    int x;
+                    int y;
+                    Event event;
+                    drawEvent(worker, &x, &y, &event);
+                    simulateEvent(worker, x, y, event);
+                }
+            }
+        });
+
+        mergeDeferredChanges(pool);
+        batchStart = batchEnd;
+
+        if (progressCallback && batchEnd >= nextProgressCheck && batchEnd < numEventsToSimulate)
+        {
+            nextProgressCheck = batchEnd + progressCheckInterval;
+            if (!progressCallback((float)batchEnd / numEventsToSimulate))
+            {
+                completed = false;
+                break;
+            }
+        }
+    }
+
+    for (auto& worker : parallelWorkers)
+    {
+        serialWorker.stats.merge(worker.stats);
+        worker.stats.reset();
+    }
+
+    *numSimulated = batchStart;
+    return completed;
+}
+
+// each worker's changes are counting-sorted by tile, keeping their order within a tile. every tile then gets the changes
+// of worker 0, then worker 1, and so on, so the sums don't depend on scheduling. a cell's sediment or moisture can end up
+// below zero when several events of a batch took from it; it is clamped to zero, as the serial events would have stopped
+// at nothing left
+void TerrainSimulation::mergeDeferredChanges(ThreadPool& pool)
+{
+    TERRABLE_TRACE_SCOPE("merge deferred changes");
+
+    const int numWorkers = pool.getNumThreads();
+    const uint32_t numTiles = (((uint32_t)width >> deferredTileShift) + 1) * (((uint32_t)height >> deferredTileShift) + 1);
+    pool.parallelFor(0, numWorkers, 1, [&](int workerBegin, int workerEnd)
+    {
+        for (int workerIdx = workerBegin; workerIdx < workerEnd; ++workerIdx)
+        {
+            EventWorker& worker = parallelWorkers[workerIdx];
+            auto& offsets = worker.tileOffsets;
+            offsets.assign(numTiles + 1, 0);
+            for (const auto& change : worker.deferredChanges)
+            {
+                ++offsets[change.tileIdx + 1];
+            }
+            for (uint32_t tileIdx = 0; tileIdx < numTiles; ++tileIdx)
+            {
+                offsets[tileIdx + 1] += offsets[tileIdx];
+            }
+
+            // placing advances each tile's offset to the start of the next tile, so shift them back afterwards
+            worker.sortedChanges.resize(worker.deferredChanges.size());
+            for (const auto& change : worker.deferredChanges)
+            {
+                worker.sortedChanges[offsets[change.tileIdx]++] = change;
+            }
+            std::copy_backward(offsets.begin(), offsets.end() - 1, offsets.end());
+            offsets[0] = 0;
+        }
+    });
+
+    pool.parallelFor(0, (int)numTiles, 16, [&](int tileBegin, int tileEnd)
+    {
+        for (int tileIdx = tileBegin; tileIdx < tileEnd; ++tileIdx)
+        {
+            for (int workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+            {
+                const EventWorker& worker = parallelWorkers[workerIdx];
+                for (uint32_t i = worker.tileOffsets[tileIdx]; i < worker.tileOffsets[tileIdx + 1]; ++i)
+                {
+                    terrainLayers[worker.sortedChanges[i].layerIdx] += worker.sortedChanges[i].change;
+                }
+            }
+
+            // bedrock is the only layer that may go negative, and only cells something was taken from can have
+            for (int workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+            {
+                const EventWorker& worker = parallelWorkers[workerIdx];
+                for (uint32_t i = worker.tileOffsets[tileIdx]; i < worker.tileOffsets[tileIdx + 1]; ++i)
+                {
+                    const DeferredChange& change = worker.sortedChanges[i];
+                    float& value = terrainLayers[change.layerIdx];
+                    if (change.change < 0.f && change.layerIdx >= planeSize && value < 0.f)
+                    {
+                        value = 0.f;
+                    }
+                }
+            }
+        }
+    });
+
+    // ghost rows and columns span tiles, so they are refreshed afterwards, on this thread
+    for (int workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+    {
+        EventWorker& worker = parallelWorkers[workerIdx];
+        for (const auto& edgeChange : worker.edgeChanges)
+        {
+            updateGhostCellsNear(edgeChange.first, edgeChange.second);
+        }
+    }
+}
+
+void TerrainSimulation::resetParallelWorkers(int numWorkers, ChangeMode changeMode)
+{
+    parallelWorkers.resize(numWorkers);
+    for (auto& worker : parallelWorkers)
+    {
+        worker.random.setSeed((int64_t)(serialWorker.random.nextDouble() * 4294967296.0));
+        worker.stats.reset();
+        worker.changeMode = changeMode;
+        worker.massChange = 0.0;
+        worker.deferredChanges.clear();
+        worker.edgeChanges.clear();
+    }
+}
+
+double TerrainSimulation::sumMass(ThreadPool& pool, bool clampOverdrawn)
+{
+    // per-row partial sums, added up in row order so the total doesn't depend on scheduling
+    std::vector<double> rowMass(height);
+    pool.parallelFor(0, height, 16, [&](int rowBegin, int rowEnd)
+    {
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                for (int terrainLayerIdx = 0; terrainLayerIdx <= (int)TerrainLayer::HUMUS; ++terrainLayerIdx)
+                {
+                    float& value = terrainLayers[posToIndex(x, y, (TerrainLayer)terrainLayerIdx)];
+                    if (clampOverdrawn && value < 0.f && terrainLayerIdx != (int)TerrainLayer::BEDROCK)
+                    {
+                        value = 0.f;
+                    }
+                    rowMass[y] += value;
+                }
+            }
+        }
+    });
+
+    double mass = 0.0;
+    for (int y = 0; y < height; ++y)
+    {
+        mass += rowMass[y];
+    }
+    return mass;
+}
+
+void TerrainSimulation::drawEvent(EventWorker& worker, int* x, int* y, Event* event)
+{
+    *x = worker.random.nextDouble() * width;
+    *y = ownedRowBegin + (int)(worker.random.nextDouble() * (ownedRowEnd - ownedRowBegin));
+    *event = (Event)(worker.random.nextDouble() * numEvents);
+}
+
+// sort keys hold the event type in the top 3 bits, then the tile index scrambled by a per-batch odd multiplier and offset
+// (a bijection, so tiles stay contiguous but the sweep direction doesn't carry over between batches), then the index of
+// the drawn position
+void TerrainSimulation::drawEventBatch(int count)
+{
+    static_assert(numEvents <= 8 && eventBatchSize <= (1 << 29), "event batch sort key fields overflow");
+
+    eventBatchKeys.resize(count);
+    eventBatchPositions.resize(count);
+
+    const uint32_t tileMultiplier = (uint32_t)(serialWorker.random.nextDouble() * 4294967296.0) | 1u;
+    const uint32_t tileOffset = (uint32_t)(serialWorker.random.nextDouble() * 4294967296.0);
+    const uint32_t tilesX = ((uint32_t)width >> eventBatchTileShift) + 1;
+
+    for (int i = 0; i < count; ++i)
+    {
+        int x;
+        int y;
+        Event event;
+        drawEvent(serialWorker, &x, &y, &event);
+
+        const uint32_t tileIdx = ((uint32_t)y >> eventBatchTileShift) * tilesX + ((uint32_t)x >> eventBatchTileShift);
+        const uint32_t tileKey = tileIdx * tileMultiplier + tileOffset;
+        eventBatchKeys[i] = ((uint64_t)event << 61) | ((uint64_t)tileKey << 29) | (uint64_t)i;
+        eventBatchPositions[i] = Vec2i(x, y);
+    }
+
+    std::sort(eventBatchKeys.begin(), eventBatchKeys.end());
+}
+
+void TerrainSimulation::simulateEvent(EventWorker& worker, int x, int y, Event event)
+{
+    TERRABLE_TRACE_SCOPE(eventNames[(int)event].c_str(), Tracer::Detail::EVENTS);
+
+    TERRABLE_STATS(
+        worker.currentEventStats = CurrentEventStats();
+        const auto statsStart = std::chrono::steady_clock::now();
+    )
+
+    switch (event)
+    {
+    case Event::RUNOFF:
+        simulateRunoffEvent(worker, x, y);
+        break;
+    case Event::TEMPERATURE:
+        simulateTemperatureEvent(x, y);
+        break;
+    case Event::LIGHTNING:
+        simulateLightningEvent(worker, x, y);
+        break;
+    case Event::GRAVITY:
+        simulateGravityEvent(worker, x, y);
+        break;
+    case Event::FIRE:
+        simulateFireEvent(x, y);
+        break;
+    }
+
+    TERRABLE_STATS(worker.stats.recordEvent(event, worker.currentEventStats, std::chrono::duration<double>(std::chrono::steady_clock::now() - statsStart).count());)
+}
+
+// TODO: make these into editable node parameters
+constexpr float bedrockSoftness = 0.004f; // higher = more erosion
+constexpr float bedrockSedimentShieldingFactor = 1.2f; // higher = more shielding
+constexpr float rockSoftness = 0.008f;
+
+constexpr float rockDepositionConstant = 0.8f; // higher = more deposition
+constexpr float sandDepositionConstant = 0.7f;
+constexpr float humusDepositionConstant = 0.6f;
+
+constexpr float sedimentCapacityConstant = 0.01f; // higher = more sediment transported
+
+constexpr float rockMoistureCapacity = 0.02f;
+constexpr float sandMoistureCapacity = 0.05f;
+constexpr float humusMoistureCapacity = 0.20f;
+
+constexpr float soilMoistureAbsorptionRate = 0.12f;
+
+constexpr float sourceMoistureReduction = 0.5f;
+
+void TerrainSimulation::applyTerrainLayerChanges(EventWorker& worker, const std::vector<TerrainLayerChange>& terrainLayerChanges)
+{
+    for (const auto& change : terrainLayerChanges)
+    {
+        // changes to ghost cells land on the cell they mirror, or leave the terrain across an open boundary
+        Vec2i pos = change.pos;
+        if (!isInside(pos) && !foldGhostPos(&pos))
+        {
+            continue;
+        }
+
+        TERRABLE_STATS(
+            if (change.change != 0.f)
+            {
+                ++worker.currentEventStats.numChanges;
+                if (change.layer <= TerrainLayer::HUMUS)
+                {
+                    worker.currentEventStats.massMoved += fabsf(change.change);
+                }
+            }
+        )
+
+        // the merge applies deferred changes and refreshes the ghost cells
+        if (worker.changeMode == ChangeMode::DEFERRED)
+        {
+            deferTerrainLayerChange(worker, pos, change.layer, change.change);
+            continue;
+        }
+
+        float& value = terrainLayers[posToIndex(pos, change.layer)];
+        if (worker.changeMode == ChangeMode::ATOMIC)
+        {
+            atomicAdd(&value, change.change);
+            if (change.layer <= TerrainLayer::HUMUS)
+            {
+                worker.massChange += change.change;
+            }
+        }
+        else
+        {
+            value += change.change;
+        }
+
+        // keep the ghost cells that depend on this one in sync
+        updateGhostCellsNear(pos, change.layer);
+    }
+}
+
+void TerrainSimulation::updateGhostCellsNear(const Vec2i& pos, TerrainLayer layer)
+{
+    const bool nearVerticalEdge = pos.x <= 1 || pos.x >= width - 2;
+    const bool nearHorizontalEdge = pos.y <= 1 || pos.y >= height - 2;
+    if (nearVerticalEdge)
+    {
+        updateGhostRow(layer, pos.y);
+        if (nearHorizontalEdge)
+        {
+            updateGhostColumn(layer, -1);
+            updateGhostColumn(layer, width);
+        }
+    }
+    if (nearHorizontalEdge)
+    {
+        updateGhostColumn(layer, pos.x);
+    }
+}
+
+// picks a downhill neighbour with probability proportional to its slope. neighbours across the edge are ghost cells, so
+// this needs no bounds checks. wrapped and open borders stand for real neighbours and can be chosen. a clamped border
+// only repeats the edge: straight across it, it is level with the cell and never downhill, but diagonally it copies a
+// neighbour along the edge, which would then be weighted twice, so clamped ghosts get weight 0 explicitly. all weights are computed up front over a fixed-size array (non-downhill neighbours get weight 0) and the pick uses one
+// random draw with selects instead of an early exit; this chooses exactly what skipping non-downhill neighbours would
+template <TerrainLayer topLayer, int numNeighbours>
+bool TerrainSimulation::calculateNextPosFromSlope(EventWorker& worker, const Vec2i& thisPos, int* directionIdx, float* slope)
+{
+    const size_t thisIdx = posToIndex(thisPos, TerrainLayer::BEDROCK);
+    const float thisElevation = calculateElevationAt<topLayer>(thisIdx);
+
+    // gather first, so the weight arithmetic is a plain loop over fixed-size arrays that the compiler vectorizes
+    std::array<float, numNeighbours> nextElevations;
+    for (int neighbourIdx = 0; neighbourIdx < numNeighbours; ++neighbourIdx)
+    {
+        nextElevations[neighbourIdx] = calculateElevationAt<topLayer>(getNeighbourIndex(thisIdx, neighbourIdx));
+    }
+
+    std::array<float, numNeighbours> slopes;
+    for (int neighbourIdx = 0; neighbourIdx < numNeighbours; ++neighbourIdx)
+    {
+        slopes[neighbourIdx] = std::max((thisElevation - nextElevations[neighbourIdx]) / neighbourDistances[neighbourIdx], 0.f);
+    }
+
+    const bool onEdge = thisPos.x == 0 || thisPos.x == width - 1 || thisPos.y == 0 || thisPos.y == height - 1;
+    if (params.boundaryMode == BoundaryMode::CLAMP && onEdge)
+    {
+        for (int neighbourIdx = 0; neighbourIdx < numNeighbours; ++neighbourIdx)
+        {
+            slopes[neighbourIdx] = isInside(thisPos + neighbourDirections[neighbourIdx]) ? slopes[neighbourIdx] : 0.f;
+        }
+    }
+
+    float totalSlope = 0.f;
+    for (int neighbourIdx = 0; neighbourIdx < numNeighbours; ++neighbourIdx)
+    {
+        totalSlope += slopes[neighbourIdx];
+    }
+
+    if (totalSlope == 0.f)
+    {
+        return false;
+    }
+
+    float rand = worker.random.nextDouble() * totalSlope;
+    int chosenIdx = numNeighbours;
+    for (int neighbourIdx = 0; neighbourIdx < numNeighbours; ++neighbourIdx)
+    {
+        const bool hit = chosenIdx == numNeighbours && rand < slopes[neighbourIdx];
+        chosenIdx = hit ? neighbourIdx : chosenIdx;
+        rand -= slopes[neighbourIdx];
+    }
+
+    // rounding can leave rand just above the last weight
+    if (chosenIdx == numNeighbours)
+    {
+        return false;
+    }
+
+    *directionIdx = chosenIdx;
+    *slope = slopes[chosenIdx];
+    return true;
+}
+
+void TerrainSimulation::simulateRunoffEvent(EventWorker& worker, int x, int y)
+{
+    // TODO: set initial water based on rainfall
+    // TODO: reduce initial water amount proportionally to plant density (water intercepted by plants and released to the atmosphere through evaporation)
+    runRunoffWalk(worker, { Vec2i(x, y), Event::RUNOFF, TerrainLayer::HUMUS, 1.6f, {}, 0 }, true);
+}
+
+void TerrainSimulation::runRunoffWalk(EventWorker& worker, const WalkState& start, bool fromSource)
+{
+    if (params.descentMode == DescentMode::D8)
+    {
+        simulateRunoffWalk<8>(worker, start, fromSource);
+    }
+    else
+    {
+        simulateRunoffWalk<4>(worker, start, fromSource);
+    }
+}
+
+template <int numNeighbours>
+void TerrainSimulation::simulateRunoffWalk(EventWorker& worker, const WalkState& start, bool fromSource)
+{
+    std::vector<TerrainLayerChange> terrainLayerChanges;
+
+    float currentWater = start.water;
+    float carriedRock = start.carried[0];
+    float carriedSand = start.carried[1];
+    float carriedHumus = start.carried[2];
+
+    Vec2i sourcePos = start.pos;
+
+    Vec2i thisPos = sourcePos;
+    Vec2i nextPos;
+    float nextPosSlope;
+    const int maxSteps = getMaxWalkSteps(worker);
+    for (int step = start.steps; ; ++step)
+    {
+        int nextDirectionIdx;
+        bool foundNextPos = calculateNextPosFromSlope<TerrainLayer::HUMUS, numNeighbours>(worker, thisPos, &nextDirectionIdx, &nextPosSlope);
+
+        // reached terrain local minimum or ran out of water
+        if (!foundNextPos || currentWater <= 0.f || step == maxSteps)
+        {
+            // TODO: what happens to excess water?
+            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::ROCK, carriedRock);
+            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::SAND, carriedSand);
+            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::HUMUS, carriedHumus);
+            break;
+        }
+
+        float thisRock = terrainLayers[posToIndex(thisPos, TerrainLayer::ROCK)];
+        float thisSand = terrainLayers[posToIndex(thisPos, TerrainLayer::SAND)];
+        float thisHumus = terrainLayers[posToIndex(thisPos, TerrainLayer::HUMUS)];
+
+        float thisMoistureCapacity =
+            thisRock * rockMoistureCapacity +
+            thisSand * sandMoistureCapacity +
+            thisHumus * humusMoistureCapacity;
+        float thisMoisture = terrainLayers[posToIndex(thisPos, TerrainLayer::MOISTURE)];
+
+        float soilAbsorption = fmin(soilMoistureAbsorptionRate / nextPosSlope, thisMoistureCapacity - thisMoisture);
+        soilAbsorption = fmin(soilAbsorption, currentWater);
+        currentWater -= soilAbsorption;
+        terrainLayerChanges.emplace_back(thisPos, TerrainLayer::MOISTURE, +soilAbsorption);
+
+        float currentSedimentCapacity = currentWater * sedimentCapacityConstant;
+
+        float currentSediment = carriedRock + carriedSand + carriedHumus;
+        if (currentSediment > currentSedimentCapacity)
+        {
+            float excessSedimentRatio = (currentSediment - currentSedimentCapacity) / currentSediment;
+
+            if (carriedRock > 0.f)
+            {
+                float rockDeposition = carriedRock * excessSedimentRatio * rockDepositionConstant;
+                carriedRock -= rockDeposition;
+                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::ROCK, rockDeposition);
+            }
+
+            if (carriedSand > 0.f)
+            {
+                float sandDeposition = carriedSand * excessSedimentRatio * sandDepositionConstant;
+                carriedSand -= sandDeposition;
+                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::SAND, sandDeposition);
+            }
+
+            if (carriedHumus > 0.f)
+            {
+                float humusDeposition = carriedHumus * excessSedimentRatio * humusDepositionConstant;
+                carriedHumus -= humusDeposition;
+                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::HUMUS, humusDeposition);
+            }
+        }
+        else
+        {
+            // TODO: dampen by vegetation amount
+            float excessSedimentCapacity = currentSedimentCapacity - currentSediment;
+
+            if (thisRock > 0.f)
+            {
+                float rockErosion = fmin(thisRock, excessSedimentCapacity) * rockSoftness;
+                terrainLayerChanges.emplace_back(thisPos, TerrainLayer::ROCK, -rockErosion);
+                carriedSand += rockErosion;
+                excessSedimentCapacity = fmax(0.f, excessSedimentCapacity - rockErosion);
+            }
+
+            float thisSediment = thisRock + thisSand + thisHumus;
+            float bedrockErosionFactor = 1.f / (1.f + bedrockSedimentShieldingFactor * thisSediment);
+            float bedrockErosion = excessSedimentCapacity * bedrockErosionFactor * bedrockSoftness;
+            terrainLayerChanges.emplace_back(thisPos, TerrainLayer::BEDROCK, -bedrockErosion);
+            carriedRock += bedrockErosion;
+        }
+
+        nextPos = thisPos + neighbourDirections[nextDirectionIdx];
+
+        // the water and its sediment go on in the subdomain that owns the row
+        if (isHaloRow(nextPos.y))
+        {
+            worker.handedOffWalks.push_back({ nextPos, Event::RUNOFF, TerrainLayer::HUMUS, currentWater,
+                { carriedRock, carriedSand, carriedHumus }, step + 1 });
+            break;
+        }
+
+        // the water and its sediment leave the terrain across an open boundary
+        if (!isInside(nextPos) && !foldGhostPos(&nextPos))
+        {
+            break;
+        }
+
+        thisPos = nextPos;
+        TERRABLE_STATS(++worker.currentEventStats.pathLength;)
+    }
+
+    applyTerrainLayerChanges(worker, terrainLayerChanges);
+    if (!fromSource)
+    {
+        return;
+    }
+
+    // "Once the runoff sequence terminates we approximate the effects of plant transpiration and seepage into groundwater
+    // by reducing the moisture at the source p0 by a constant amount."
+    float& sourceMoisture = terrainLayers[posToIndex(sourcePos, TerrainLayer::MOISTURE)];
+    if (worker.changeMode == ChangeMode::DEFERRED)
+    {
+        // the layers don't hold this walk's changes yet, so add the moisture it left at the source
+        float currentMoisture = sourceMoisture;
+        for (const auto& change : terrainLayerChanges)
+        {
+            if (change.layer == TerrainLayer::MOISTURE && change.pos == sourcePos)
+            {
+                currentMoisture += change.change;
+            }
+        }
+        const float reducedMoisture = fmax(currentMoisture - sourceMoistureReduction, 0.f);
+        deferTerrainLayerChange(worker, sourcePos, TerrainLayer::MOISTURE, reducedMoisture - currentMoisture);
+        return;
+    }
+
+    const float reducedMoisture = fmax(sourceMoisture - sourceMoistureReduction, 0.f);
+    if (worker.changeMode == ChangeMode::ATOMIC)
+    {
+        atomicAdd(&sourceMoisture, reducedMoisture - sourceMoisture);
+    }
+    else
+    {
+        sourceMoisture = reducedMoisture;
+    }
+}
+
+void TerrainSimulation::simulateTemperatureEvent(int x, int y)
+{
+    // TODO
+}
+
+// TODO: make these into editable node parameters
+constexpr float k_l_c = 1.2f; // curvature scaling factor
+constexpr float k_l_s = 2.0f; // minimum curvature for which maximum lightning chance is achieved
+constexpr float lightningBedrockToRemove = 0.4f;
+
+void TerrainSimulation::simulateLightningEvent(EventWorker& worker, int x, int y)
+{
+    std::vector<TerrainLayerChange> terrainLayerChanges;
+
+    Vec2i sourcePos = { x, y };
+
+    Vec2i thisPos = sourcePos;
+
+    // float thisBedrock = terrainLayers[posToIndex(thisPos, TerrainLayer::BEDROCK)];
+    float thisRock = terrainLayers[posToIndex(thisPos, TerrainLayer::ROCK)];
+    float thisSand = terrainLayers[posToIndex(thisPos, TerrainLayer::SAND)];
+    float thisVegetation = terrainLayers[posToIndex(thisPos, TerrainLayer::VEGETATION)];
+    float thisDeadVegetation = terrainLayers[posToIndex(thisPos, TerrainLayer::DEAD_VEGETATION)];
+
+    std::vector<std::pair<Vec2i, float>> nextPosCandidates;
+
+    float localCurvature = calculateCuravature(x, y);
+
+    // k_L = maximum probability that lightning strikes at that cell
+    float k_L = params.lightningChance;
+
+    // lp = probability of damage
+    float lp = k_L * fmin(1.f, expf(k_l_c * (localCurvature - k_l_s)));
+
+    float r = worker.random.nextDouble(); // get a random float between 0 and 1
+
+    // damage done
+    if (r < lp) {
+        // TODO: destroy vegetation if present and exit early accordingly
+        //       based on the paper's wording, it seems like no damage is done to bedrock if vegetation is destroyed by lightning
+
+        // obtain 4 directly surrounding coords
+        std::vector<Vec2i> nextPosCandidates;
+        nextPosCandidates.emplace_back(thisPos);
+
+        // candidates across the edge are ghost cells, which applyTerrainLayerChanges folds back per the boundary mode
+        for (const auto& cardinalDirection : cardinalDirections)
+        {
+            nextPosCandidates.emplace_back(thisPos + cardinalDirection);
+        }
+
+        // spread granular materials to 4 directly surrounding coords
+        for (Vec2i candidate : nextPosCandidates)
+        {
+            float r2 = worker.random.nextDouble(); // get a random float between 0 and 1
+            if (r2 > 0.3f) {
+                terrainLayerChanges.emplace_back(candidate, TerrainLayer::ROCK, lightningBedrockToRemove * 0.25f);
+            }
+            else {
+                terrainLayerChanges.emplace_back(candidate, TerrainLayer::SAND, lightningBedrockToRemove * 0.25f);
+            }
+            break;
+        }
+
+        // remove bedrock in current coord
+        terrainLayerChanges.emplace_back(thisPos, TerrainLayer::BEDROCK, -lightningBedrockToRemove);
+    }
+
+    // make all changes
+    applyTerrainLayerChanges(worker, terrainLayerChanges);
+}
+
+// TODO: make these into editable node parameters
+constexpr float rockFrictionAngleDegrees = 22.f;
+constexpr float sandFrictionAngleDegrees = 18.f;
+constexpr float humusFrictionAngleDegrees = 16.f;
+
+void TerrainSimulation::simulateGravityEvent(EventWorker& worker, int x, int y)
+{
+    float rand = worker.random.nextDouble();
+    const TerrainLayer layer = rand < 0.333333333333333f ? TerrainLayer::ROCK
+        : rand < 0.666666666666666f ? TerrainLayer::SAND : TerrainLayer::HUMUS;
+    runGravityWalk(worker, { Vec2i(x, y), Event::GRAVITY, layer, 0.f, {}, 0 });
+}
+
+void TerrainSimulation::runGravityWalk(EventWorker& worker, const WalkState& start)
+{
+    // the layer and neighbourhood are picked once per walk, so the whole walk runs on code specialized for them
+    auto walk = [&](auto layer, float frictionAngleDegrees)
+    {
+        if (params.descentMode == DescentMode::D8)
+        {
+            simulateGravityWalk<decltype(layer)::value, 8>(worker, start, frictionAngleDegrees);
+        }
+        else
+        {
+            simulateGravityWalk<decltype(layer)::value, 4>(worker, start, frictionAngleDegrees);
+        }
+    };
+
+    if (start.layer == TerrainLayer::ROCK)
+    {
+        walk(std::integral_constant<TerrainLayer, TerrainLayer::ROCK>(), rockFrictionAngleDegrees);
+    }
+    else if (start.layer == TerrainLayer::SAND)
+    {
+        walk(std::integral_constant<TerrainLayer, TerrainLayer::SAND>(), sandFrictionAngleDegrees);
+    }
+    else
+    {
+        walk(std::integral_constant<TerrainLayer, TerrainLayer::HUMUS>(), humusFrictionAngleDegrees);
+    }
+}
+
+template <TerrainLayer terrainLayer, int numNeighbours>
+void TerrainSimulation::simulateGravityWalk(EventWorker& worker, const WalkState& start, float frictionAngleDegrees)
+{
+    std::vector<TerrainLayerChange> terrainLayerChanges;
+
+    // TODO: increase friction angle based on vegetation
+    const float frictionSlope = tanf(frictionAngleDegrees * degToRad);
+
+    // a continued walk first lands the sediment it moved across the subdomain border; like every other change of the
+    // walk, it is applied once the walk ends
+    constexpr int carriedIdx = (int)terrainLayer - (int)TerrainLayer::ROCK;
+    if (start.carried[carriedIdx] != 0.f)
+    {
+        terrainLayerChanges.emplace_back(start.pos, terrainLayer, start.carried[carriedIdx]);
+    }
+
+    Vec2i thisPos = start.pos;
+    int nextDirectionIdx;
+    float nextPosSlope;
+    const int maxSteps = getMaxWalkSteps(worker);
+    for (int step = start.steps; step < maxSteps; ++step)
+    {
+        float thisSediment = terrainLayers[posToIndex(thisPos, terrainLayer)];
+        if (thisSediment <= 0.f || !calculateNextPosFromSlope<terrainLayer, numNeighbours>(worker, thisPos, &nextDirectionIdx, &nextPosSlope))
+        {
+            break;
+        }
+
+        // diagonal steps are longer, so they need a proportionally larger drop to overcome friction
+        const float frictionHeight = frictionSlope * neighbourDistances[nextDirectionIdx];
+        Vec2i nextPos = thisPos + neighbourDirections[nextDirectionIdx];
+
+        float thisElevation = calculateElevation<terrainLayer>(thisPos);
+        float nextElevation = calculateElevation<terrainLayer>(nextPos);
+        float heightGap = thisElevation - nextElevation;
+        if (heightGap < frictionHeight)
+        {
+            break;
+        }
+
+        // TODO: additional contribution proportional to curvature
+        float sedimentToMove = fmin(heightGap - frictionHeight, thisSediment) * worker.random.nextDouble();
+
+        terrainLayerChanges.emplace_back(thisPos, terrainLayer, -sedimentToMove);
+
+        // the subdomain that owns the row takes the sediment and carries on from there
+        if (isHaloRow(nextPos.y))
+        {
+            WalkState handedOff = { nextPos, Event::GRAVITY, terrainLayer, 0.f, {}, step + 1 };
+            handedOff.carried[carriedIdx] = sedimentToMove;
+            worker.handedOffWalks.push_back(handedOff);
+            break;
+        }
+
+        terrainLayerChanges.emplace_back(nextPos, terrainLayer, sedimentToMove);
+
+        // TODO: destroy vegetation
+
+        // sediment moved across an open boundary is gone
+        if (!isInside(nextPos) && !foldGhostPos(&nextPos))
+        {
+            break;
+        }
+
+        thisPos = nextPos;
+        TERRABLE_STATS(++worker.currentEventStats.pathLength;)
+    }
+
+    applyTerrainLayerChanges(worker, terrainLayerChanges);
+}
+
+void TerrainSimulation::simulateFireEvent(int x, int y)
+{
+    // TODO
+}
+
+// the slope specializations are defined here, so instantiate the ones that are meaningful outside this file
+template float TerrainSimulation::calculateSlope<TerrainLayer::BEDROCK>(int x, int y) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::ROCK>(int x, int y) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::SAND>(int x, int y) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::HUMUS>(int x, int y) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::BEDROCK>(const Vec2i& pos1, const Vec2i& pos2) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::ROCK>(const Vec2i& pos1, const Vec2i& pos2) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::SAND>(const Vec2i& pos1, const Vec2i& pos2) const;
+template float TerrainSimulation::calculateSlope<TerrainLayer::HUMUS>(const Vec2i& pos1, const Vec2i& pos2) const;
@@ -0,0 +1,493 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "enums.hpp"
+#include "layer_allocator.hpp"
+#include "random.hpp"
+#include "simulation_stats.hpp"
+#include "vec2i.hpp"
+
+namespace Terrable
+{
+
+class ThreadPool;
+
+// called every progressCheckInterval events with the fraction of the current year done, but not once the year's last
+// event has run, so a year is never left stopped with nothing to do; returning false stops the year, which the next
+// stepSimulation then continues
+using ProgressCallback = std::function<bool(float yearProgress)>;
+
+struct SimulationParams
+{
+    // maximum probability that lightning strikes a cell
+    float lightningChance = 0.005f;
+
+    BoundaryMode boundaryMode = BoundaryMode::CLAMP;
+
+    DescentMode descentMode = DescentMode::D4;
+
+    EventOrder eventOrder = EventOrder::RANDOM;
+
+    ExecutionMode executionMode = ExecutionMode::SERIAL;
+
+    // hogwild only: once bedrock through humus drift from their expected total by more than this fraction within a
+    // year, the rest of the year runs serially
+    float maxMassDrift = 1e-3f;
+
+    bool operator==(const SimulationParams& other) const
+    {
+        return lightningChance == other.lightningChance && boundaryMode == other.boundaryMode
+            && descentMode == other.descentMode && eventOrder == other.eventOrder
+            && executionMode == other.executionMode && maxMassDrift == other.maxMassDrift;
+    }
+    bool operator!=(const SimulationParams& other) const { return !(*this == other); }
+};
+
+// where a runoff or gravity walk is and what it brings there. walks that step out of a simulation's owned rows stop
+// in this state, to be carried on by the simulation owning the row they stepped into
+struct WalkState
+{
+    Vec2i pos;
+    Event event; // RUNOFF or GRAVITY
+    TerrainLayer layer; // gravity walks only: the layer they move
+    float water; // runoff walks only
+    std::array<float, 3> carried; // rock, sand and humus arriving at pos
+    int steps; // taken so far, counted against the walk length cap
+};
+
+#ifdef TERRABLE_TILED_LAYOUT
+// interleaves the low 16 bits of v with zeros, giving the x part of a Morton code
+constexpr size_t spreadMortonBits(size_t v)
+{
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    return (v | (v << 1)) & 0x55555555;
+}
+#endif
+
+// the erosion simulation itself, free of Houdini types so it can run outside a Houdini session
+class TerrainSimulation
+{
+private:
+    // a change recorded by a deferred worker: the tile of its cell, and where in terrainLayers it goes
+    struct DeferredChange
+    {
+        uint32_t tileIdx;
+        float change;
+        size_t layerIdx;
+    };
+
+    // how applyTerrainLayerChanges lands a worker's changes: straight on the layers, as atomic adds, or into its list of
+    // deferred changes
+    enum class ChangeMode
+    {
+        DIRECT,
+        ATOMIC,
+        DEFERRED
+    };
+
+    // what a thread needs to run events independently: its own random sequence and stats, and how its changes are applied
+    struct EventWorker
+    {
+        Random random;
+        SimulationStats stats;
+        TERRABLE_STATS(CurrentEventStats currentEventStats;)
+
+        ChangeMode changeMode = ChangeMode::DIRECT;
+
+        // sum of the changes applied to bedrock through humus (hogwild workers only), for the conservation check
+        double massChange = 0.0;
+
+        // deferred workers only: changes in the order they were made, then the same sorted by tile, with the start of
+        // each tile's run in tileOffsets. cells near the edge whose ghost cells need a refresh after the merge are
+        // listed separately
+        std::vector<DeferredChange> deferredChanges;
+        std::vector<DeferredChange> sortedChanges;
+        std::vector<uint32_t> tileOffsets;
+        std::vector<std::pair<Vec2i, TerrainLayer>> edgeChanges;
+
+        // walks that stepped out of the owned rows, in the order they did
+        std::vector<WalkState> handedOffWalks;
+    };
+
+    int width;
+    int height;
+
+    // each plane has a one-cell ghost border filled according to params.boundaryMode, so neighbour lookups never need
+    // bounds checks. cells are stored by padded position (x + 1, y + 1), either row by row or, when built with
+    // TERRABLE_TILED_LAYOUT, in square tiles laid out row by row with the cells of each tile in Morton (Z) order, so a
+    // walk's neighbours in any direction usually share a tile. stride is the index distance between consecutive padded
+    // rows (row-major) or tile rows (tiled); planeSize is the size of one padded plane
+    std::vector<float, LayerAllocator<float>> terrainLayers;
+    size_t stride;
+    size_t planeSize;
+
+    // index offsets (row-major layout only) and world-space distances to the neighbours in neighbourDirections order
+    std::array<ptrdiff_t, 8> neighbourOffsets;
+    std::array<float, 8> neighbourDistances;
+
+    float cellSize; // assuming square cells
+
+    SimulationParams params;
+
+    // the serial worker's random sequence also draws event positions, so a seed fixes a serial run completely
+    EventWorker serialWorker;
+    std::vector<EventWorker> parallelWorkers;
+    double lastMassDrift;
+
+    // events start in rows [ownedRowBegin, ownedRowEnd) only; the rest is a halo kept up to date by their owners
+    int ownedRowBegin;
+    int ownedRowEnd;
+
+    // events of the current year run so far; only nonzero after a year was stopped partway
+    int yearEventsDone;
+
+    // reused between batches with EventOrder::BATCHED: one sort key per event, indexing into the drawn positions. the
+    // batch drawn last covers events [eventBatchStart, eventBatchEnd) of the current year, and is kept when a year stops
+    // partway through it
+    std::vector<uint64_t> eventBatchKeys;
+    std::vector<Vec2i> eventBatchPositions;
+    int eventBatchStart;
+    int eventBatchEnd;
+
+public:
+    TerrainSimulation();
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    float getCellSize() const { return cellSize; }
+
+    // all layers start at 0 unless clearLayers is false, in which case only the ghost border and the padding around the
+    // terrain are zeroed, and the caller must write every cell of every layer through writeLayerRow and then call
+    // updateGhostCells (or something that does) before reading the border. the planes are filled on pool, or on the shared pool if none is given. the
+    // buffer is kept if the new size needs as many values, and then stays placed as it was
+    void setTerrainSize(int newWidth, int newHeight, float newCellSize, ThreadPool* pool = nullptr,
+        MemoryPlacement placement = MemoryPlacement::SPREAD, bool clearLayers = true);
+
+    // sets every value of one layer's plane, ghost border included, to 0; for a layer setTerrainSize left uncleared that
+    // no input provides
+    void clearLayer(TerrainLayer layer, ThreadPool* pool = nullptr);
+
+    const SimulationParams& getParams() const { return params; }
+    void setParams(const SimulationParams& newParams);
+
+    // also drops a year stopped partway, so the next stepSimulation starts a new one
+    void setSeed(int seed)
+    {
+        serialWorker.random.setSeed(seed);
+        yearEventsDone = 0;
+    }
+
+    // only populated when built with TERRABLE_ENABLE_STATS; events run through simulateEvent are recorded
+    const SimulationStats& getStats() const { return serialWorker.stats; }
+    void resetStats() { serialWorker.stats.reset(); }
+
+    // relative difference between the mass of bedrock through humus after the last hogwild year and what its applied
+    // changes add up to, counting sediment that stale reads overdrew below zero; 0 after serial years
+    double getLastMassDrift() const { return lastMassDrift; }
+
+    // fraction of the current year run so far; 0 unless the last stepSimulation was stopped partway
+    float getYearProgress() const { return (float)yearEventsDone / ((float)getNumOwnedCells() * numEvents); }
+
+    // makes this a subdomain of a larger terrain split into bands of rows: events only start in rows [rowBegin, rowEnd),
+    // so a year runs one event of each type per owned cell on average, and runoff and gravity walks stepping into any
+    // other row stop there and are handed off. the other rows are a halo, which whoever owns them keeps up to date
+    // between calls to stepSimulation. setTerrainSize owns every row again
+    void setOwnedRows(int rowBegin, int rowEnd);
+    int getOwnedRowBegin() const { return ownedRowBegin; }
+    int getOwnedRowEnd() const { return ownedRowEnd; }
+
+    // the walks handed off since the last call, in a fixed order for a given seed and thread count
+    std::vector<WalkState> takeHandedOffWalks();
+
+    // carries on a walk that another subdomain handed off into one of the owned rows; it may be handed off again
+    void continueWalk(const WalkState& walk);
+
+    // ends a handed-off walk where it is, leaving the sediment it carries there
+    void depositWalk(const WalkState& walk);
+
+#ifdef TERRABLE_TILED_LAYOUT
+    static constexpr int tileShift = 4; // 16 x 16 cells, 1 KiB per layer
+    static constexpr int tileSize = 1 << tileShift;
+    static constexpr size_t tileCells = (size_t)tileSize * tileSize;
+
+    // bits of an in-tile Morton code that hold x and y respectively
+    static constexpr size_t mortonXMask = spreadMortonBits(tileSize - 1);
+    static constexpr size_t mortonYMask = mortonXMask << 1;
+#endif
+    static constexpr bool tiledLayout =
+#ifdef TERRABLE_TILED_LAYOUT
+        true;
+#else
+        false;
+#endif
+
+    // copy count cells of row y starting at x0 out of or into a layer, whatever the memory layout
+    void readLayerRow(TerrainLayer layer, int x0, int y, int count, float* out) const;
+    void writeLayerRow(TerrainLayer layer, int x0, int y, int count, const float* in);
+    float getLayerValue(int x, int y, TerrainLayer layer) const { return terrainLayers[posToIndex(x, y, layer)]; }
+
+    // refills the ghost border of every plane; needed after writeLayerRow before simulating events directly
+    // (stepSimulation and initializeHumusFromBedrock do this themselves)
+    void updateGhostCells();
+
+    // valid for -1 <= x <= width and -1 <= y <= height, where the outermost ring is the ghost border
+    inline size_t posToIndex(int x, int y, TerrainLayer layer) const
+    {
+#ifdef TERRABLE_TILED_LAYOUT
+        const size_t paddedX = x + 1;
+        const size_t paddedY = y + 1;
+        const size_t tileIdx = (paddedY >> tileShift) * stride + ((paddedX >> tileShift) << (2 * tileShift));
+        const size_t mortonCode = spreadMortonBits(paddedX & (tileSize - 1)) | (spreadMortonBits(paddedY & (tileSize - 1)) << 1);
+        return ((size_t)layer * planeSize) + tileIdx + mortonCode;
+#else
+        return ((size_t)layer * planeSize) + ((size_t)(y + 1) * stride) + (x + 1);
+#endif
+    }
+    inline size_t posToIndex(const Vec2i& pos, TerrainLayer layer) const
+    {
+        return posToIndex(pos.x, pos.y, layer);
+    }
+
+    // index of the neighbour in direction neighbourDirections[directionIdx] of the cell at cellIdx, in the same layer
+    inline size_t getNeighbourIndex(size_t cellIdx, int directionIdx) const
+    {
+#ifdef TERRABLE_TILED_LAYOUT
+        return stepMorton<mortonYMask, mortonXMask>(stepMorton<mortonXMask, mortonYMask>(cellIdx,
+            neighbourDirections[directionIdx].x, tileCells), neighbourDirections[directionIdx].y, stride);
+#else
+        return cellIdx + neighbourOffsets[directionIdx];
+#endif
+    }
+
+    // sum of layers from bedrock up to and including topLayer; the runtime versions dispatch to these once per call,
+    // hot loops should pick the specialization up front instead
+    template <TerrainLayer topLayer>
+    inline float calculateElevation(int x, int y) const
+    {
+        return calculateElevationAt<topLayer>(posToIndex(x, y, TerrainLayer::BEDROCK));
+    }
+    template <TerrainLayer topLayer>
+    inline float calculateElevation(const Vec2i& pos) const
+    {
+        return calculateElevation<topLayer>(pos.x, pos.y);
+    }
+    template <TerrainLayer topLayer>
+    float calculateSlope(int x, int y) const;
+    template <TerrainLayer topLayer>
+    float calculateSlope(const Vec2i& pos1, const Vec2i& pos2) const;
+
+    float calculateElevation(int x, int y, TerrainLayer topLayer = TerrainLayer::HUMUS) const;
+    inline float calculateElevation(const Vec2i& pos, TerrainLayer topLayer = TerrainLayer::HUMUS) const
+    {
+        return calculateElevation(pos.x, pos.y, topLayer);
+    }
+    float calculateSlope(int x, int y, TerrainLayer topLayer = TerrainLayer::HUMUS) const;
+    float calculateSlope(const Vec2i& pos1, const Vec2i& pos2, TerrainLayer topLayer = TerrainLayer::HUMUS) const;
+    float calculateCuravature(int x, int y) const;
+
+    // topmost layer thicker than the color threshold, falling back to bedrock
+    int calculateTopVisibleLayer(int x, int y) const;
+
+    // fills humus from the slope of the bedrock plane, which must already be populated; other layers are left as they are
+    void initializeHumusFromBedrock(ThreadPool& pool);
+
+    // writes combined height and per-channel color planes (each width * height); null outputs are skipped
+    void writeSurface(ThreadPool& pool, float* heightOut, const std::array<float*, 3>& colorOut) const;
+
+    // same for count cells of row y starting at x0, written contiguously to the outputs; null outputs are skipped
+    void writeSurfaceRow(int x0, int y, int count, float* heightOut, const std::array<float*, 3>& colorOut) const;
+
+    // makes this a proxy of source at 1 / factor of its resolution (rounded up), with source's params: every proxy cell
+    // averages the source cells it covers and cells grow factor times larger, so slopes stay the same. a year still runs
+    // each event type once per cell, so a proxy year takes about 1 / factor^2 of the time
+    void downsampleFrom(const TerrainSimulation& source, int factor, ThreadPool* pool = nullptr);
+
+    // makes this a copy of source's size, params, layer planes and stats, for reading only: none of the event state,
+    // worker change lists or buffers come along. the planes are kept when the size stays the same, so copying into
+    // the same simulation again doesn't allocate
+    void copyLayersFrom(const TerrainSimulation& source, ThreadPool* pool = nullptr);
+
+    // adds to every layer how proxy has changed from initial, two proxies of this simulation made by downsampleFrom with
+    // factor, bilinearly upsampled. layers above bedrock are clamped at 0 afterwards
+    void addUpsampledChange(const TerrainSimulation& initial, const TerrainSimulation& proxy, int factor,
+        ThreadPool* pool = nullptr);
+
+    static constexpr int progressCheckInterval = 4096;
+
+    // events drawn at once with EventOrder::BATCHED, and the side of the square tiles they are grouped by
+    static constexpr int eventBatchSize = 1 << 18;
+    static constexpr int eventBatchTileShift = 5;
+
+    // events each thread runs per batch with ExecutionMode::DEFERRED, and the side of the square tiles the merge of a
+    // batch is split into
+    static constexpr int deferredWorkerBatchSize = 1024;
+    static constexpr int deferredTileShift = 5;
+
+    // simulates one year; returns false if progressCallback cancelled it partway, leaving the terrain as it was at that
+    // point. the next call then runs the rest of that year instead of a new one; in serial and deferred mode the result
+    // is the same as if the year had run in one go. parallel execution modes run on pool, or on the shared pool if none
+    // is given
+    bool stepSimulation(const ProgressCallback& progressCallback = nullptr, ThreadPool* pool = nullptr);
+    void simulateEvent(int x, int y, Event event) { simulateEvent(serialWorker, x, y, event); }
+
+    // runoff and gravity walk over 4 or 8 neighbours per params.descentMode
+    void simulateRunoffEvent(int x, int y) { simulateRunoffEvent(serialWorker, x, y); }
+    void simulateTemperatureEvent(int x, int y);
+    void simulateLightningEvent(int x, int y) { simulateLightningEvent(serialWorker, x, y); }
+    void simulateGravityEvent(int x, int y) { simulateGravityEvent(serialWorker, x, y); }
+    void simulateFireEvent(int x, int y);
+
+private:
+    struct TerrainLayerChange
+    {
+        Vec2i pos;
+        TerrainLayer layer;
+        float change;
+
+        TerrainLayerChange(Vec2i pos, TerrainLayer layer, float change)
+            : pos(pos), layer(layer), change(change)
+        {
+        }
+    };
+    void applyTerrainLayerChanges(EventWorker& worker, const std::vector<TerrainLayerChange>& terrainLayerChanges);
+
+    // queues a change to the cell at pos, which must be inside the terrain, for the next merge
+    inline void deferTerrainLayerChange(EventWorker& worker, const Vec2i& pos, TerrainLayer layer, float change)
+    {
+        const uint32_t tilesX = ((uint32_t)width >> deferredTileShift) + 1;
+        const uint32_t tileIdx = ((uint32_t)pos.y >> deferredTileShift) * tilesX + ((uint32_t)pos.x >> deferredTileShift);
+        worker.deferredChanges.push_back({ tileIdx, change, posToIndex(pos, layer) });
+        if (isNearEdge(pos))
+        {
+            worker.edgeChanges.emplace_back(pos, layer);
+        }
+    }
+
+    void simulateEvent(EventWorker& worker, int x, int y, Event event);
+    void simulateRunoffEvent(EventWorker& worker, int x, int y);
+    void simulateLightningEvent(EventWorker& worker, int x, int y);
+    void simulateGravityEvent(EventWorker& worker, int x, int y);
+
+    // runoff or gravity walks from start onwards; fromSource is false for walks continued from another subdomain
+    void runRunoffWalk(EventWorker& worker, const WalkState& start, bool fromSource);
+    void runGravityWalk(EventWorker& worker, const WalkState& start);
+
+    // run events firstEventIdx onwards of the year and set *numSimulated to the index reached; all return false if
+    // progressCallback cancelled the year. the hogwild version also stops early if the mass drift bound is exceeded
+    bool simulateSerialEvents(int firstEventIdx, const ProgressCallback& progressCallback, int* numSimulated);
+    bool simulateHogwildEvents(ThreadPool& pool, int firstEventIdx, const ProgressCallback& progressCallback, int* numSimulated);
+    bool simulateDeferredEvents(ThreadPool& pool, int firstEventIdx, const ProgressCallback& progressCallback, int* numSimulated);
+
+    // sorts every worker's deferred changes by tile, then adds them to the layers tile by tile, worker by worker
+    void mergeDeferredChanges(ThreadPool& pool);
+
+    // seeds the first numWorkers parallel workers from the serial worker and sets them up to apply changes changeMode
+    void resetParallelWorkers(int numWorkers, ChangeMode changeMode);
+
+    // total of bedrock through humus over the terrain, optionally clamping negative sediment to 0 first
+    double sumMass(ThreadPool& pool, bool clampOverdrawn);
+
+    // elevation of the cell whose bedrock is at cellIdx
+    template <TerrainLayer topLayer>
+    inline float calculateElevationAt(size_t cellIdx) const
+    {
+        return sumLayers(cellIdx, std::make_integer_sequence<int, (int)topLayer + 1>());
+    }
+
+    // left fold from 0 so the result matches summing the layers one by one in a loop
+    template <int... layerIdxs>
+    inline float sumLayers(size_t cellIdx, std::integer_sequence<int, layerIdxs...>) const
+    {
+        return (0.f + ... + terrainLayers[cellIdx + layerIdxs * planeSize]);
+    }
+
+    // draws an event's position, uniformly over the owned rows, and its type from worker's random sequence
+    void drawEvent(EventWorker& worker, int* x, int* y, Event* event);
+
+    // draws count events and sorts them into eventBatchKeys by type, then by tile in a shuffled tile order
+    void drawEventBatch(int count);
+
+#ifdef TERRABLE_TILED_LAYOUT
+    // moves a tiled index by delta (-1, 0, or 1) along the axis whose in-tile Morton bits are axisMask. incrementing
+    // sets the other axis' bits first so the carry ripples straight through them; leaving the tile on either side moves
+    // to the adjacent tile, which is tileStep away
+    template <size_t axisMask, size_t otherMask>
+    static inline size_t stepMorton(size_t cellIdx, int delta, size_t tileStep)
+    {
+        const size_t code = cellIdx & (tileCells - 1);
+        const size_t axisBits = code & axisMask;
+        const size_t incremented = ((code | otherMask) + 1) & axisMask;
+        const size_t decremented = (axisBits - 1) & axisMask;
+        const size_t newAxisBits = delta > 0 ? incremented : delta < 0 ? decremented : axisBits;
+        const size_t tileBase = cellIdx - code;
+        const size_t newTileBase = delta > 0 && axisBits == axisMask ? tileBase + tileStep
+            : delta < 0 && axisBits == 0 ? tileBase - tileStep : tileBase;
+        return newTileBase + (newAxisBits | (code & otherMask));
+    }
+
+    template <typename Func>
+    void forEachTiledRowCell(TerrainLayer layer, int x0, int y, int count, Func&& func) const;
+#endif
+
+    inline bool isInside(const Vec2i& pos) const
+    {
+        return pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height;
+    }
+
+    // whether row y, which may be a ghost row, is a halo row owned by another subdomain
+    inline bool isHaloRow(int y) const
+    {
+        return (y < ownedRowBegin && y >= 0) || (y >= ownedRowEnd && y < height);
+    }
+
+    int getNumOwnedCells() const { return width * (ownedRowEnd - ownedRowBegin); }
+
+    // maps a ghost position back onto the grid; returns false if it has none, i.e. it is off an open boundary
+    bool foldGhostPos(Vec2i* pos) const;
+
+    // whether any ghost cell depends on the cell at pos, which must be inside the terrain
+    inline bool isNearEdge(const Vec2i& pos) const
+    {
+        return pos.x <= 1 || pos.x >= width - 2 || pos.y <= 1 || pos.y >= height - 2;
+    }
+
+    // refreshes the ghost cells that depend on the cell at pos after it changed
+    void updateGhostCellsNear(const Vec2i& pos, TerrainLayer layer);
+
+    // zeroes every value of every plane that isn't a terrain cell: the ghost border, and the padding past it up to the
+    // end of the plane or, in the tiled layout, the unused cells of the last tile row and column
+    void clearPadding();
+
+    float getGhostValue(float edgeValue, float innerValue, float oppositeValue) const;
+    void updateGhostRow(TerrainLayer layer, int y);
+    void updateGhostColumn(TerrainLayer layer, int x);
+
+    // picks one of the first numNeighbours entries of neighbourDirections
+    template <TerrainLayer topLayer, int numNeighbours>
+    bool calculateNextPosFromSlope(EventWorker& worker, const Vec2i& thisPos, int* directionIdx, float* slope);
+
+    // serial and deferred walks only ever go downhill on terrain that doesn't change under them, so they end on their
+    // own. hogwild walks see other workers' changes and could in principle cycle, so they are cut off after a generous
+    // length
+    int getMaxWalkSteps(const EventWorker& worker) const
+    {
+        return worker.changeMode == ChangeMode::ATOMIC ? 4 * (width + height) : std::numeric_limits<int>::max();
+    }
+
+    template <int numNeighbours>
+    void simulateRunoffWalk(EventWorker& worker, const WalkState& start, bool fromSource);
+
+    template <TerrainLayer layer, int numNeighbours>
+    void simulateGravityWalk(EventWorker& worker, const WalkState& start, float frictionAngleDegrees);
+};
+
+} // namespace Terrable
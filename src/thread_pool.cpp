@@ -0,0 +1,147 @@
+#include "thread_pool.hpp"
+#include "numa.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+using namespace Terrable;
+
+ThreadPool::ThreadPool(int numThreads, bool pinThreads)
+    : stopping(false)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    const int numNodes = getNumaNodeCount();
+    for (int threadIdx = 1; threadIdx < numThreads; ++threadIdx)
+    {
+        const int node = pinThreads ? threadIdx * numNodes / numThreads : -1;
+        workers.emplace_back([this, node]()
+        {
+            if (node >= 0)
+            {
+                pinCurrentThreadToNumaNode(node);
+            }
+            workerLoop();
+        });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)>& func)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    grainSize = std::max(1, grainSize);
+    const int numChunks = (end - begin + grainSize - 1) / grainSize;
+
+    if (numChunks == 1 || workers.empty())
+    {
+        func(begin, end);
+        return;
+    }
+
+    // chunks are claimed from a shared counter, so helpers that only start after everything is claimed exit immediately.
+    // the caller claims chunks too and then waits only for chunks that are already running, which can't deadlock.
+    struct SharedState
+    {
+        std::atomic<int> nextChunk{ 0 };
+        int completedChunks = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<SharedState>();
+
+    auto runChunks = [state, begin, end, grainSize, numChunks, &func]()
+    {
+        int completed = 0;
+        int chunkIdx;
+        while ((chunkIdx = state->nextChunk.fetch_add(1)) < numChunks)
+        {
+            TERRABLE_TRACE_SCOPE("parallel chunk", "chunk", chunkIdx);
+            const int rangeBegin = begin + chunkIdx * grainSize;
+            func(rangeBegin, std::min(end, rangeBegin + grainSize));
+            ++completed;
+        }
+
+        if (completed > 0)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->completedChunks += completed;
+            if (state->completedChunks == numChunks)
+            {
+                state->done.notify_all();
+            }
+        }
+    };
+
+    const int numHelpers = std::min((int)workers.size(), numChunks - 1);
+    for (int helperIdx = 0; helperIdx < numHelpers; ++helperIdx)
+    {
+        submit(runChunks);
+    }
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&]() { return state->completedChunks == numChunks; });
+}
+
+ThreadPool& ThreadPool::getShared()
+{
+    const char* pinThreads = std::getenv("TERRABLE_PIN_THREADS");
+    static ThreadPool sharedPool(0, pinThreads && std::strcmp(pinThreads, "1") == 0);
+    return sharedPool;
+}
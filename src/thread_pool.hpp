@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Terrable
+{
+
+// fixed-size worker pool used for whole-grid passes in the simulation core
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping;
+
+public:
+    // numThreads counts the calling thread, which also does work inside parallelFor; 0 = hardware concurrency. with
+    // pinThreads, the worker threads are spread evenly over the NUMA nodes in order and each kept on its node's cores
+    // (the calling thread is left alone)
+    explicit ThreadPool(int numThreads = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int getNumThreads() const { return (int)workers.size() + 1; }
+
+    // calls func(rangeBegin, rangeEnd) over [begin, end) split into chunks of at most grainSize; blocks until all chunks are done
+    void parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)>& func);
+
+    void submit(std::function<void()> task);
+
+    // process-wide pool shared by all users that don't bring their own; TERRABLE_PIN_THREADS=1 pins its threads
+    static ThreadPool& getShared();
+
+private:
+    void workerLoop();
+};
+
+} // namespace Terrable
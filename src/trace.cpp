@@ -0,0 +1,213 @@
+#include "trace.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace Terrable;
+
+std::atomic<bool> Tracer::enabled(false);
+std::atomic<Tracer::Detail> Tracer::detail(Tracer::Detail::ZONES);
+
+namespace
+{
+
+struct TraceEvent
+{
+    char phase; // 'X' = complete zone, 'C' = counter
+    std::string name;
+    double timestamp; // microseconds since the trace started
+    double duration;
+    std::string args; // preformatted JSON object body
+};
+
+// the owning thread appends under mutex, and start and stop take it to clear or drain the events
+struct ThreadBuffer
+{
+    int threadId;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+};
+
+std::mutex tracerMutex;
+std::string tracePath;
+// read by recording threads without tracerMutex, so kept as clock ticks in an atomic
+std::atomic<Tracer::Clock::rep> traceStartTicks(0);
+std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers; // buffers outlive their threads, so a trace can be written after workers exit
+
+ThreadBuffer& getThreadBuffer()
+{
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer)
+    {
+        std::lock_guard<std::mutex> lock(tracerMutex);
+        threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = threadBuffers.back().get();
+        buffer->threadId = (int)threadBuffers.size();
+    }
+    return *buffer;
+}
+
+double toMicroseconds(Tracer::Clock::duration duration)
+{
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+Tracer::Clock::time_point getTraceStart()
+{
+    return Tracer::Clock::time_point(Tracer::Clock::duration(traceStartTicks.load(std::memory_order_relaxed)));
+}
+
+void appendEvent(TraceEvent&& event)
+{
+    ThreadBuffer& buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(std::move(event));
+}
+
+void writeEscaped(std::ostream& out, const std::string& str)
+{
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out << '\\';
+        }
+        out << c;
+    }
+}
+
+} // namespace
+
+bool Tracer::start(const std::string& path, Detail newDetail)
+{
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    if (enabled.load())
+    {
+        return false;
+    }
+
+    for (auto& buffer : threadBuffers)
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        buffer->events.clear();
+    }
+
+    tracePath = path;
+    detail.store(newDetail);
+    traceStartTicks.store(Clock::now().time_since_epoch().count());
+    enabled.store(true);
+    return true;
+}
+
+bool Tracer::stop(std::string* error)
+{
+    std::lock_guard<std::mutex> lock(tracerMutex);
+    if (!enabled.load())
+    {
+        return true;
+    }
+    enabled.store(false);
+
+    std::ofstream file(tracePath);
+    if (!file)
+    {
+        *error = "could not open " + tracePath;
+        return false;
+    }
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& buffer : threadBuffers)
+    {
+        // threads may still be recording; they wait while their buffer is taken, then append to an empty one
+        std::vector<TraceEvent> events;
+        {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            events.swap(buffer->events);
+        }
+        if (events.empty())
+        {
+            continue;
+        }
+
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId
+             << ",\"args\":{\"name\":\"thread " << buffer->threadId << "\"}}";
+        first = false;
+
+        for (const auto& event : events)
+        {
+            file << ",\n{\"name\":\"";
+            writeEscaped(file, event.name);
+            file << "\",\"cat\":\"terrable\",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << buffer->threadId
+                 << ",\"ts\":" << event.timestamp;
+            if (event.phase == 'X')
+            {
+                file << ",\"dur\":" << event.duration;
+            }
+            if (!event.args.empty())
+            {
+                file << ",\"args\":{" << event.args << "}";
+            }
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    if (!file)
+    {
+        *error = "failed writing " + tracePath;
+        return false;
+    }
+    return true;
+}
+
+const char* Tracer::getEnvPath()
+{
+    const char* path = std::getenv("TERRABLE_TRACE");
+    return path && path[0] ? path : nullptr;
+}
+
+Tracer::Detail Tracer::getEnvDetail()
+{
+    const char* envDetail = std::getenv("TERRABLE_TRACE_DETAIL");
+    return envDetail && std::strcmp(envDetail, "events") == 0 ? Detail::EVENTS : Detail::ZONES;
+}
+
+void Tracer::recordZone(const char* name, Clock::time_point start, Clock::time_point end, const char* argName, long long argValue)
+{
+    // a zone left open across a stop and start belongs to neither trace
+    const Clock::time_point traceStart = getTraceStart();
+    if (!isEnabled() || start < traceStart)
+    {
+        return;
+    }
+
+    TraceEvent event;
+    event.phase = 'X';
+    event.name = name;
+    event.timestamp = toMicroseconds(start - traceStart);
+    event.duration = toMicroseconds(end - start);
+    if (argName)
+    {
+        event.args = std::string("\"") + argName + "\":" + std::to_string(argValue);
+    }
+    appendEvent(std::move(event));
+}
+
+void Tracer::recordCounter(const char* name, const std::string* seriesNames, const double* values, int numSeries)
+{
+    TraceEvent event;
+    event.phase = 'C';
+    event.name = name;
+    event.timestamp = toMicroseconds(Clock::now() - getTraceStart());
+    event.duration = 0.0;
+    for (int seriesIdx = 0; seriesIdx < numSeries; ++seriesIdx)
+    {
+        event.args += (seriesIdx > 0 ? ",\"" : "\"") + seriesNames[seriesIdx] + "\":" + std::to_string(values[seriesIdx]);
+    }
+    appendEvent(std::move(event));
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace Terrable
+{
+
+// collects scoped zones into per-thread buffers and writes them as a Chrome trace JSON file (viewable in Perfetto).
+// when no trace is running, a zone costs one relaxed atomic load. while one is, each buffer has its own lock, so threads
+// still recording when a trace is stopped or started (a background job, pool workers) don't race with the drain.
+class Tracer
+{
+public:
+    enum class Detail
+    {
+        ZONES, // cook stages, years, parallel chunks, and per-year event kind totals
+        EVENTS // additionally one zone per simulated event; only practical for small grids
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // returns false if a trace is already running
+    static bool start(const std::string& path, Detail detail = Detail::ZONES);
+    // stops tracing and writes the file. zones still open then are left out, as are zones that started before the
+    // trace did
+    static bool stop(std::string* error);
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static bool isEnabled(Detail minDetail) { return isEnabled() && detail.load(std::memory_order_relaxed) >= minDetail; }
+
+    // TERRABLE_TRACE=path enables tracing; TERRABLE_TRACE_DETAIL=events adds per-event zones
+    static const char* getEnvPath();
+    static Detail getEnvDetail();
+
+    static void recordZone(const char* name, Clock::time_point start, Clock::time_point end, const char* argName = nullptr, long long argValue = 0);
+    template <size_t N>
+    static void recordCounter(const char* name, const std::array<std::string, N>& seriesNames, const std::array<double, N>& values)
+    {
+        recordCounter(name, seriesNames.data(), values.data(), (int)N);
+    }
+    static void recordCounter(const char* name, const std::string* seriesNames, const double* values, int numSeries);
+
+private:
+    static std::atomic<bool> enabled;
+    static std::atomic<Detail> detail;
+};
+
+class TraceScope
+{
+private:
+    const char* name;
+    const char* argName;
+    long long argValue;
+    Tracer::Clock::time_point start;
+    bool active;
+
+public:
+    explicit TraceScope(const char* name, Tracer::Detail minDetail = Tracer::Detail::ZONES)
+        : name(name), argName(nullptr), argValue(0), active(Tracer::isEnabled(minDetail))
+    {
+        if (active)
+        {
+            start = Tracer::Clock::now();
+        }
+    }
+
+    // zone with one integer argument, e.g. the index of a simulated year
+    TraceScope(const char* name, const char* argName, long long argValue)
+        : name(name), argName(argName), argValue(argValue), active(Tracer::isEnabled())
+    {
+        if (active)
+        {
+            start = Tracer::Clock::now();
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (active)
+        {
+            Tracer::recordZone(name, start, Tracer::Clock::now(), argName, argValue);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define TERRABLE_TRACE_CONCAT_INNER(a, b) a##b
+#define TERRABLE_TRACE_CONCAT(a, b) TERRABLE_TRACE_CONCAT_INNER(a, b)
+#define TERRABLE_TRACE_SCOPE(...) ::Terrable::TraceScope TERRABLE_TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+} // namespace Terrable
@@ -0,0 +1,19 @@
+#pragma once
+
+namespace Terrable
+{
+    // minimal integer grid position so the simulation core doesn't depend on UT_Vector2i
+    struct Vec2i
+    {
+        int x;
+        int y;
+
+        constexpr Vec2i() : x(0), y(0) {}
+        constexpr Vec2i(int x, int y) : x(x), y(y) {}
+
+        constexpr Vec2i operator+(const Vec2i& other) const { return Vec2i(x + other.x, y + other.y); }
+        constexpr Vec2i operator-(const Vec2i& other) const { return Vec2i(x - other.x, y - other.y); }
+        constexpr bool operator==(const Vec2i& other) const { return x == other.x && y == other.y; }
+        constexpr bool operator!=(const Vec2i& other) const { return !(*this == other); }
+    };
+}